@@ -15,6 +15,19 @@ Compilação (exemplo):
 - g++ -std=c++17 -O2 -pthread -o loja_server SistemaLojaOnlineServer.cpp
   (coloque httplib.h e json.hpp no mesmo diretório ou em include path)
 
+Execução: ./loja_server [--checkout=direct|combining] [--node=0..63] [--stock-locking=atomic|global|striped]
+- --checkout=combining agrupa checkouts simultâneos num único acesso à Store (padrão: direct)
+- --node identifica a instância nos ids de pedido (64 bits, únicos entre reinícios)
+- --stock-locking escolhe como pedidos concorrentes se excluem na reserva de estoque (padrão: atomic)
+- --reservation-ttl=N reserva o estoque já em /cart/add e o devolve após N s sem checkout (máx. 16383, cerca de 4,5 h; valores maiores são recusados)
+- --flash-sale=1,2 divide o estoque desses produtos em contadores por núcleo (alta disputa num único item)
+- --checkout-async=N processa /checkout em N workers dedicados (202 + GET /checkout/status); --checkout-queue limita a fila (padrão 10000)
+- --idempotency-ttl / --idempotency-capacity: quanto tempo (padrão 86400 s) e quantas (padrão 100000) respostas de /checkout
+  com Idempotency-Key ficam guardadas para repetições
+- --cart-shards=N divide os carrinhos em N shards com lock próprio (padrão: 4 por núcleo)
+- --cart-idle-ttl=N descarta carrinhos sem acesso há N s; --cart-memory-mb=M despeja os menos usados (LRU aproximado)
+  quando os carrinhos passam de M MB (reservas voltam ao estoque; contadores em /stats)
+
 Observações: esta é uma API em memória, sem persistência. Para produção adicione banco (SQLite/Postgres), segurança e validação.
 
 ---------- Modelagem UML (PlantUML) ----------
@@ -35,19 +48,36 @@ class Customer {
   -vector<CartItem> cart
 }
 class Order {
-  -int id
+  -int64_t id
+  -int customerId
   -vector<CartItem> items
   -double total
 }
+class Catalog {
+  -vector<int> ids
+  -vector<double> prices
+  -vector<StockCounter> stocks
+  -string arena
+  +view(slot: size_t): ProductView
+}
 class Store {
-  -vector<Product> products
+  -Catalog catalog
+  -unordered_map<int, size_t> index
+  -SearchIndex searchIndex
+  -set<pair<double, size_t>> priceIndex
+  -shared_mutex mtx
   -vector<Category> categories
-  +findProductById(id: int): Product*
+  +withProduct(id: int, f): bool
+  +snapshot(): shared_ptr<const CatalogSnapshot>
+  +search(query: string, limit: size_t): vector<pair<int, Product>>
   +placeOrder(o: Order): bool
 }
 Customer "1" *-- "*" CartItem
 Order "1" *-- "*" CartItem
-Store "1" o-- "*" Product
+OrderRepository "1" o-- "*" Order
+Store "1" *-- "1" Catalog
+Catalog "1" o-- "*" Product
+ProductView ..> Catalog
 @enduml
 
 ---------- Código: SistemaLojaOnlineServer.cpp ----------
@@ -61,7 +91,25 @@ Store "1" o-- "*" Product
 #include <memory>
 #include <algorithm>
 #include <iomanip>
+#include <optional>
+#include <string_view>
 #include <mutex>
+#include <atomic>
+#include <shared_mutex>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
+#include <set>
+#include <type_traits>
+#include <deque>
+#include <chrono>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <cctype>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "httplib.h"        // coloque httplib.h no include path
 #include "json.hpp"        // coloque json.hpp (nlohmann) no include path
@@ -105,114 +153,1853 @@ public:
     }
 };
 
+// Valores monetários são somados em centavos inteiros: somas em double acumulariam
+// desvios (0.1 + 0.2 != 0.3). Os preços já entram no catálogo arredondados a centavos.
+inline int64_t toCents(double value) { return llround(value * 100); }
+inline double fromCents(int64_t cents) { return double(cents) / 100; }
+
 struct CartItem {
     int productId;
     string productName;
     double unitPrice;
     int qty;
-    double subtotal() const { return unitPrice * qty; }
-    json toJson() const { return json{{"productId", productId},{"productName", productName},{"unitPrice", unitPrice},{"qty", qty},{"subtotal", subtotal()}}; }
+    int reserved = 0; // unidades já retiradas do estoque por uma reserva de carrinho
+    int64_t subtotalCents() const { return toCents(unitPrice) * qty; }
+    double subtotal() const { return fromCents(subtotalCents()); }
+    json toJson() const {
+        json j{{"productId", productId},{"productName", productName},{"unitPrice", unitPrice},{"qty", qty},{"subtotal", subtotal()}};
+        if (reserved > 0) j["reserved"] = reserved;
+        return j;
+    }
 };
 
 class Order {
 private:
-    int id;
+    int64_t id;
+    int customerId;
     vector<CartItem> items;
     double total;
 public:
-    Order(int id=0, vector<CartItem> items = {}): id(id), items(move(items)), total(0.0) { calculateTotal(); }
+    Order(int64_t id=0, vector<CartItem> items = {}, int customerId=0): id(id), customerId(customerId), items(move(items)), total(0.0) { calculateTotal(); }
+    // total já conhecido (subtotal mantido pelo carrinho): evita somar os itens de novo
+    Order(int64_t id, vector<CartItem> items, int customerId, double total): id(id), customerId(customerId), items(move(items)), total(total) {}
     void calculateTotal() {
-        total = 0.0;
-        for (const auto &it : items) total += it.subtotal();
+        int64_t cents = 0;
+        for (const auto &it : items) cents += it.subtotalCents();
+        total = fromCents(cents);
     }
     double getTotal() const { return total; }
-    int getId() const { return id; }
+    int64_t getId() const { return id; }
+    int getCustomerId() const { return customerId; }
     const vector<CartItem>& getItems() const { return items; }
     json toJson() const {
         json arr = json::array();
         for (const auto &it : items) arr.push_back(it.toJson());
-        return json{{"id", id},{"items", arr},{"total", total}};
+        // id como string: passa de 2^53 e perderia precisão em clientes que leem números como double
+        return json{{"id", to_string(id)},{"customerId", customerId},{"items", arr},{"total", total}};
+    }
+};
+
+// ---------- Normalização para busca ----------
+// Chave de busca: minúsculas e sem acentos ("Teclado Mecânico" -> "teclado mecanico").
+// Cobre o Latin-1 (U+00C0..U+00FF) e descarta acentos combinantes (U+0300..U+036F);
+// outros caracteres UTF-8 são mantidos. Texto só ASCII passa pelo caminho SSE2,
+// 16 bytes por vez.
+inline void foldUtf8Char(string_view text, size_t &i, string &out) {
+    // U+00C0..U+00FF, indexado pelo segundo byte (0x80..0xBF) de 0xC3 xx
+    static const char *const latin1[64] = {
+        "a","a","a","a","a","a","ae","c","e","e","e","e","i","i","i","i",
+        "d","n","o","o","o","o","o","\xC3\x97","o","u","u","u","u","y","\xC3\xBE","ss",
+        "a","a","a","a","a","a","ae","c","e","e","e","e","i","i","i","i",
+        "d","n","o","o","o","o","o","\xC3\xB7","o","u","u","u","u","y","\xC3\xBE","y"};
+    unsigned char c = static_cast<unsigned char>(text[i]);
+    if (c < 0x80) { out += static_cast<char>(c >= 'A' && c <= 'Z' ? c + 32 : c); ++i; return; }
+    unsigned char next = i + 1 < text.size() ? static_cast<unsigned char>(text[i + 1]) : 0;
+    bool continuation = (next & 0xC0) == 0x80;
+    if (c == 0xC3 && continuation) { out += latin1[next - 0x80]; i += 2; return; }
+    if (((c == 0xCC) || (c == 0xCD && next <= 0xAF)) && continuation) { i += 2; return; } // acento combinante
+    size_t len = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+    len = min(len, text.size() - i);
+    out.append(text.data() + i, len);
+    i += len;
+}
+
+inline string foldForSearch(string_view text) {
+    string out;
+    out.reserve(text.size());
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i before = _mm_set1_epi8('A' - 1), after = _mm_set1_epi8('Z' + 1), caseBit = _mm_set1_epi8(0x20);
+    while (i + 16 <= text.size()) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text.data() + i));
+        if (_mm_movemask_epi8(v) != 0) { // há bytes não ASCII: bloco pelo caminho escalar
+            size_t stop = i + 16;
+            while (i < stop) foldUtf8Char(text, i, out);
+            continue;
+        }
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, before), _mm_cmplt_epi8(v, after));
+        v = _mm_add_epi8(v, _mm_and_si128(upper, caseBit));
+        char buf[16];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(buf), v);
+        out.append(buf, 16);
+        i += 16;
+    }
+#endif
+    while (i < text.size()) foldUtf8Char(text, i, out);
+    return out;
+}
+
+// ---------- Nomes internados ----------
+// Nomes de produto internados: cada nome distinto é guardado uma única vez e os
+// carrinhos guardam só o id (32 bits). O Catalog interna o nome na inclusão do
+// produto (lock exclusivo da Store), então o caminho do carrinho nunca toca no mutex.
+// Os nomes ficam em blocos que nunca se movem nem são liberados: ler pelo id não
+// precisa de lock.
+class NameInterner {
+private:
+    // mesmo alcance da StockTable (~268M): o interner nunca limita o tamanho do catálogo
+    static constexpr size_t ChunkBits = 14, ChunkSize = size_t(1) << ChunkBits, MaxChunks = size_t(1) << 14;
+    shared_mutex mtx; // protege ids, count e a escrita nos blocos
+    unordered_map<string_view, uint32_t> ids; // views apontam para os nomes nos blocos
+    atomic<string*> chunks[MaxChunks];
+    uint32_t count = 0;
+
+    NameInterner() { for (auto &c : chunks) c.store(nullptr, memory_order_relaxed); }
+    ~NameInterner() { for (auto &c : chunks) delete[] c.load(memory_order_relaxed); }
+public:
+    static constexpr size_t Capacity = ChunkSize * MaxChunks;
+
+    static NameInterner& instance() { static NameInterner in; return in; }
+
+    uint32_t intern(const string &name) {
+        {
+            shared_lock<shared_mutex> lock(mtx);
+            auto it = ids.find(name);
+            if (it != ids.end()) return it->second;
+        }
+        unique_lock<shared_mutex> lock(mtx);
+        auto it = ids.find(name);
+        if (it != ids.end()) return it->second;
+        uint32_t id = count;
+        size_t c = id >> ChunkBits;
+        if (c >= MaxChunks) throw length_error("NameInterner cheio");
+        string *chunk = chunks[c].load(memory_order_relaxed);
+        if (!chunk) { chunk = new string[ChunkSize]; chunks[c].store(chunk, memory_order_release); }
+        string &slot = chunk[id & (ChunkSize - 1)];
+        slot = name;
+        ids.emplace(string_view(slot), id);
+        ++count;
+        return id;
+    }
+    // id precisa ter vindo de intern (quem o recebeu já enxerga o nome escrito)
+    const string& name(uint32_t id) const { return chunks[id >> ChunkBits].load(memory_order_acquire)[id & (ChunkSize - 1)]; }
+    size_t size() { shared_lock<shared_mutex> lock(mtx); return count; }
+};
+
+// ---------- Catálogo colunar ----------
+// Campos quentes (id, preço, estoque) ficam em arrays contíguos, que podem ser
+// percorridos sem tocar nos textos; nome e descrição ficam num único arena.
+class ProductView;
+
+// Estoque de um produto em modo promoção relâmpago: o total é dividido em
+// sub-contadores, cada um na sua linha de cache (sem falso compartilhamento). Cada
+// thread retira do seu; só quando ele esgota puxa unidades dos outros (metade do
+// doador, ou o que faltar). O total lido é aproximado enquanto há movimentação, e
+// perto do fim do estoque uma retirada pode falhar enquanto unidades estão em trânsito.
+class FlashStock {
+private:
+    struct alignas(64) Shard { atomic<int> units{0}; };
+    unique_ptr<Shard[]> shards;
+    size_t count;
+
+    size_t home() const {
+        static thread_local size_t h = hash<thread::id>()(this_thread::get_id());
+        return h % count;
+    }
+    static bool takeFrom(atomic<int> &v, int qty) {
+        int cur = v.load(memory_order_relaxed);
+        while (cur >= qty)
+            if (v.compare_exchange_weak(cur, cur - qty, memory_order_acq_rel, memory_order_relaxed)) return true;
+        return false;
+    }
+public:
+    FlashStock(int total, size_t shardCount): shards(new Shard[max<size_t>(shardCount, 1)]), count(max<size_t>(shardCount, 1)) {
+        for (size_t i = 0; i < count; ++i) shards[i].units.store(total / int(count) + (int(i) < total % int(count) ? 1 : 0), memory_order_relaxed);
+    }
+
+    int total() const {
+        int sum = 0;
+        for (size_t i = 0; i < count; ++i) sum += shards[i].units.load(memory_order_acquire);
+        return sum;
+    }
+
+    bool tryTake(int qty) {
+        size_t h = home();
+        auto &mine = shards[h].units;
+        if (takeFrom(mine, qty)) return true;
+        for (size_t step = 1; step < count; ++step) { // sub-contador local seco: rebalanceia
+            auto &donor = shards[(h + step) % count].units;
+            int cur = donor.load(memory_order_relaxed);
+            while (cur > 0) {
+                int move = max((cur + 1) / 2, min(cur, qty));
+                if (donor.compare_exchange_weak(cur, cur - move, memory_order_acq_rel, memory_order_relaxed)) { mine.fetch_add(move, memory_order_acq_rel); break; }
+            }
+            if (takeFrom(mine, qty)) return true;
+        }
+        return false;
+    }
+    void give(int qty) { shards[home()].units.fetch_add(qty, memory_order_acq_rel); }
+};
+
+// Contadores de estoque, alterados só por operações atômicas. Ficam em segmentos
+// contíguos que nunca mudam de endereço: cópias do Catalog (snapshots) compartilham
+// a mesma tabela e enxergam o estoque vivo, e leitores sem lock não são afetados
+// quando novos produtos entram. Produtos em promoção relâmpago desviam para um
+// FlashStock (ponteiro num segmento paralelo, alocado só quando usado).
+class StockTable {
+private:
+    static constexpr size_t SegmentBits = 14;
+    static constexpr size_t SegmentSize = size_t(1) << SegmentBits;
+    static constexpr size_t MaxSegments = size_t(1) << 14; // até ~268M produtos
+    static_assert(SegmentSize * MaxSegments <= NameInterner::Capacity, "o catálogo interna o nome de cada produto");
+    unique_ptr<atomic<atomic<int>*>[]> segments;
+    unique_ptr<atomic<atomic<FlashStock*>*>[]> flashSegments;
+    size_t count = 0; // alterado só por append (lock exclusivo da Store)
+
+    atomic<int>& at(size_t slot) const {
+        return segments[slot >> SegmentBits].load(memory_order_acquire)[slot & (SegmentSize - 1)];
+    }
+    FlashStock* flash(size_t slot) const {
+        atomic<FlashStock*> *seg = flashSegments[slot >> SegmentBits].load(memory_order_acquire);
+        return seg ? seg[slot & (SegmentSize - 1)].load(memory_order_acquire) : nullptr;
+    }
+public:
+    StockTable(): segments(new atomic<atomic<int>*>[MaxSegments]), flashSegments(new atomic<atomic<FlashStock*>*>[MaxSegments]) {
+        for (size_t i = 0; i < MaxSegments; ++i) {
+            segments[i].store(nullptr, memory_order_relaxed);
+            flashSegments[i].store(nullptr, memory_order_relaxed);
+        }
+    }
+    ~StockTable() {
+        for (size_t i = 0; i < MaxSegments; ++i) {
+            delete[] segments[i].load(memory_order_relaxed);
+            atomic<FlashStock*> *seg = flashSegments[i].load(memory_order_relaxed);
+            if (!seg) continue;
+            for (size_t j = 0; j < SegmentSize; ++j) delete seg[j].load(memory_order_relaxed);
+            delete[] seg;
+        }
+    }
+    StockTable(const StockTable&) = delete;
+    StockTable& operator=(const StockTable&) = delete;
+
+    size_t append(int stock) {
+        size_t seg = count >> SegmentBits;
+        if (seg >= MaxSegments) throw length_error("StockTable cheia");
+        atomic<int> *data = segments[seg].load(memory_order_relaxed);
+        if (!data) { data = new atomic<int>[SegmentSize]; segments[seg].store(data, memory_order_release); }
+        data[count & (SegmentSize - 1)].store(stock, memory_order_release);
+        return count++;
+    }
+
+    int get(size_t slot) const {
+        if (FlashStock *f = flash(slot)) return f->total();
+        return at(slot).load(memory_order_acquire);
+    }
+    // retira qty só se houver o suficiente (nunca fica negativo)
+    bool tryTake(size_t slot, int qty) {
+        if (qty <= 0) return false;
+        if (FlashStock *f = flash(slot)) return f->tryTake(qty);
+        auto &v = at(slot);
+        int cur = v.load(memory_order_relaxed);
+        while (cur >= qty)
+            if (v.compare_exchange_weak(cur, cur - qty, memory_order_acq_rel, memory_order_relaxed)) return true;
+        return false;
+    }
+    void give(size_t slot, int qty) {
+        if (qty <= 0) return;
+        if (FlashStock *f = flash(slot)) f->give(qty); else at(slot).fetch_add(qty, memory_order_acq_rel);
+    }
+
+    // Passa o produto para sub-contadores por núcleo. Chamar com o lock exclusivo da
+    // Store (nenhuma retirada em andamento); leitores sem lock passam a ler o FlashStock.
+    void enableFlash(size_t slot, size_t shards) {
+        if (flash(slot)) return;
+        size_t seg = slot >> SegmentBits;
+        atomic<FlashStock*> *fs = flashSegments[seg].load(memory_order_relaxed);
+        if (!fs) {
+            fs = new atomic<FlashStock*>[SegmentSize];
+            for (size_t j = 0; j < SegmentSize; ++j) fs[j].store(nullptr, memory_order_relaxed);
+            flashSegments[seg].store(fs, memory_order_release);
+        }
+        fs[slot & (SegmentSize - 1)].store(new FlashStock(at(slot).load(memory_order_acquire), shards), memory_order_release);
+        at(slot).store(0, memory_order_release);
+    }
+};
+
+class Catalog {
+private:
+    struct TextRef { size_t offset; size_t length; };
+    vector<int> ids;
+    vector<double> prices;
+    shared_ptr<StockTable> stocks = make_shared<StockTable>(); // compartilhada entre cópias
+    vector<TextRef> names;
+    vector<TextRef> descriptions;
+    vector<TextRef> nameKeys; // chaves de busca (foldForSearch), calculadas uma vez na inclusão
+    vector<TextRef> descriptionKeys;
+    vector<uint32_t> nameIds; // NameInterner
+    string arena; // textos concatenados
+
+    TextRef storeText(const string &s) { TextRef r{arena.size(), s.size()}; arena += s; return r; }
+    // reaproveita o texto original quando ele já está normalizado
+    TextRef storeKey(TextRef original, const string &s) { string key = foldForSearch(s); return key == s ? original : storeText(key); }
+    string_view text(TextRef r) const { return string_view(arena).substr(r.offset, r.length); }
+public:
+    size_t size() const { return ids.size(); }
+
+    // devolve o slot do novo produto
+    size_t append(const Product &p) {
+        uint32_t nameId = NameInterner::instance().intern(p.getName()); // pode lançar: antes de alterar as colunas
+        ids.push_back(p.getId());
+        prices.push_back(fromCents(toCents(p.getPrice()))); // centavos exatos: somas no carrinho e no pedido coincidem
+        stocks->append(p.getStock());
+        names.push_back(storeText(p.getName()));
+        descriptions.push_back(storeText(p.getDescription()));
+        nameKeys.push_back(storeKey(names.back(), p.getName()));
+        descriptionKeys.push_back(storeKey(descriptions.back(), p.getDescription()));
+        nameIds.push_back(nameId);
+        return ids.size() - 1;
+    }
+
+    const vector<int>& idColumn() const { return ids; }
+    int id(size_t slot) const { return ids[slot]; }
+    double price(size_t slot) const { return prices[slot]; }
+    int stock(size_t slot) const { return stocks->get(slot); }
+    string_view name(size_t slot) const { return text(names[slot]); }
+    uint32_t nameId(size_t slot) const { return nameIds[slot]; }
+    string_view description(size_t slot) const { return text(descriptions[slot]); }
+    string_view nameKey(size_t slot) const { return text(nameKeys[slot]); }
+    string_view descriptionKey(size_t slot) const { return text(descriptionKeys[slot]); }
+
+    // retira qty do estoque só se houver o suficiente (nunca fica negativo)
+    bool tryTakeStock(size_t slot, int qty) { return stocks->tryTake(slot, qty); }
+    void returnStock(size_t slot, int qty) { stocks->give(slot, qty); }
+    void enableFlashStock(size_t slot, size_t shards) { stocks->enableFlash(slot, shards); }
+
+    ProductView view(size_t slot) const;
+};
+
+// Visão leve de um produto do catálogo: não copia os textos. Vale enquanto o
+// Catalog de origem existir e não receber novos produtos.
+class ProductView {
+private:
+    const Catalog *catalog;
+    size_t slot;
+public:
+    ProductView(const Catalog *catalog, size_t slot): catalog(catalog), slot(slot) {}
+
+    int getId() const { return catalog->id(slot); }
+    string_view getName() const { return catalog->name(slot); }
+    uint32_t getNameId() const { return catalog->nameId(slot); }
+    string_view getDescription() const { return catalog->description(slot); }
+    double getPrice() const { return catalog->price(slot); }
+    int getStock() const { return catalog->stock(slot); }
+
+    json toJson() const {
+        return json{{"id", getId()},{"name", getName()},{"description", getDescription()},{"price", getPrice()},{"stock", getStock()}};
+    }
+    Product toProduct() const { return Product(getId(), string(getName()), string(getDescription()), getPrice(), getStock()); }
+};
+
+inline ProductView Catalog::view(size_t slot) const { return ProductView(this, slot); }
+
+// ---------- Reclamação de memória por épocas (EBR) ----------
+// Leitores anunciam a época global ao entrar num Guard e saem sem tocar em locks.
+// Um objeto aposentado só é liberado quando todo leitor ativo anunciou uma época
+// posterior à aposentadoria, ou seja, quando ninguém mais pode estar com ele.
+class EpochManager {
+public:
+    static constexpr size_t MaxReaders = 512; // threads leitoras simultâneas
+
+    static EpochManager& instance() { static EpochManager m; return m; }
+
+    class Guard {
+    private:
+        EpochManager &m;
+    public:
+        explicit Guard(EpochManager &m = instance()): m(m) { m.enter(); }
+        ~Guard() { m.exit(); }
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+    };
+
+    // obj é destruído (última referência) quando nenhum leitor puder mais alcançá-lo;
+    // deve ser chamado depois de o objeto ter sido despublicado
+    void retire(shared_ptr<const void> obj) {
+        lock_guard<mutex> lock(retireMtx);
+        retired.emplace_back(globalEpoch.fetch_add(1, memory_order_seq_cst), move(obj));
+        uint64_t oldest = Idle;
+        for (auto &s : slots) oldest = min(oldest, s.epoch.load(memory_order_seq_cst));
+        retired.erase(remove_if(retired.begin(), retired.end(),
+                                [&](const pair<uint64_t, shared_ptr<const void>> &r){ return r.first < oldest; }),
+                      retired.end());
+    }
+private:
+    static constexpr uint64_t Idle = ~uint64_t(0);
+    struct alignas(64) ReaderSlot { atomic<uint64_t> epoch{Idle}; atomic<bool> owned{false}; };
+    struct ThreadState {
+        EpochManager *owner = nullptr;
+        size_t slot = 0;
+        int depth = 0; // guards aninhados na mesma thread
+        ~ThreadState() { if (owner) owner->slots[slot].owned.store(false, memory_order_release); }
+    };
+    static ThreadState& self() { static thread_local ThreadState s; return s; }
+
+    ReaderSlot slots[MaxReaders];
+    atomic<uint64_t> globalEpoch{1};
+    mutex retireMtx;
+    vector<pair<uint64_t, shared_ptr<const void>>> retired;
+
+    EpochManager() = default;
+
+    void enter() {
+        ThreadState &t = self();
+        if (!t.owner) {
+            for (size_t i = 0;; i = (i + 1) % MaxReaders) {
+                bool expected = false;
+                if (slots[i].owned.compare_exchange_strong(expected, true, memory_order_acq_rel)) { t.slot = i; break; }
+                if (i == MaxReaders - 1) this_thread::yield();
+            }
+            t.owner = this;
+        }
+        if (t.depth++ == 0) slots[t.slot].epoch.store(globalEpoch.load(memory_order_seq_cst), memory_order_seq_cst);
+    }
+    void exit() {
+        ThreadState &t = self();
+        if (--t.depth == 0) slots[t.slot].epoch.store(Idle, memory_order_release);
+    }
+};
+
+// ---------- Busca textual (índice invertido) ----------
+// Quebra um texto já normalizado (foldForSearch) em termos: sequências de letras e
+// dígitos. Bytes acima de 0x7F (UTF-8 que não foi dobrado) contam como letras.
+template <typename Emit>
+void forEachTerm(string_view text, Emit emit) {
+    string term;
+    for (char ch : text) {
+        unsigned char c = static_cast<unsigned char>(ch);
+        if (isalnum(c) || c >= 0x80) { term += ch; continue; }
+        if (!term.empty()) { emit(term); term.clear(); }
+    }
+    if (!term.empty()) emit(term);
+}
+
+// termo -> lista de slots (em ordem crescente, pois os slots só crescem).
+// Mantido incrementalmente pela Store a cada produto incluído, a partir das chaves
+// de busca do catálogo; a consulta é normalizada do mesmo jeito, uma vez.
+class SearchIndex {
+public:
+    struct Hit { size_t slot; int score; };
+private:
+    static constexpr uint8_t InName = 1, InDescription = 2;
+    struct Posting { size_t slot; uint8_t fields; };
+    unordered_map<string, vector<Posting>> postings;
+
+    static int weight(uint8_t fields) { return (fields & InName ? 3 : 0) + (fields & InDescription ? 1 : 0); }
+public:
+    void add(size_t slot, string_view nameKey, string_view descriptionKey) {
+        unordered_map<string, uint8_t> terms;
+        forEachTerm(nameKey, [&](const string &t){ terms[t] |= InName; });
+        forEachTerm(descriptionKey, [&](const string &t){ terms[t] |= InDescription; });
+        for (auto &t : terms) postings[t.first].push_back(Posting{slot, t.second});
+    }
+
+    // Produtos que contêm todos os termos da consulta, ordenados por relevância
+    // (termo no nome vale 3, na descrição 1). A interseção começa pela lista menor.
+    vector<Hit> search(string_view query, size_t limit) const {
+        vector<const vector<Posting>*> lists;
+        bool missing = false;
+        forEachTerm(foldForSearch(query), [&](const string &t){
+            auto it = postings.find(t);
+            if (it == postings.end()) missing = true; else lists.push_back(&it->second);
+        });
+        if (missing || lists.empty()) return {};
+        sort(lists.begin(), lists.end());
+        lists.erase(unique(lists.begin(), lists.end()), lists.end()); // termo repetido na consulta
+        sort(lists.begin(), lists.end(), [](auto *a, auto *b){ return a->size() < b->size(); });
+
+        vector<Hit> hits;
+        hits.reserve(lists[0]->size());
+        for (const auto &p : *lists[0]) hits.push_back(Hit{p.slot, weight(p.fields)});
+        for (size_t l = 1; l < lists.size() && !hits.empty(); ++l) {
+            const auto &list = *lists[l];
+            size_t out = 0, j = 0;
+            for (const auto &h : hits) {
+                while (j < list.size() && list[j].slot < h.slot) ++j;
+                if (j == list.size()) break;
+                if (list[j].slot == h.slot) hits[out++] = Hit{h.slot, h.score + weight(list[j].fields)};
+            }
+            hits.resize(out);
+        }
+        auto better = [](const Hit &a, const Hit &b){ return a.score != b.score ? a.score > b.score : a.slot < b.slot; };
+        if (hits.size() > limit) {
+            partial_sort(hits.begin(), hits.begin() + limit, hits.end(), better);
+            hits.resize(limit);
+        } else {
+            sort(hits.begin(), hits.end(), better);
+        }
+        return hits;
     }
 };
 
 // ---------- Repositório/Loja em memória ----------
+// Visão imutável e versionada do catálogo. Leitores compartilham a mesma cópia
+// e serializam sem segurar o lock da Store. O estoque não é copiado: os contadores
+// atômicos são compartilhados, então a versão só muda quando entram produtos.
+// Os produtos são percorridos em ordem de id, o que permite paginar por cursor (?after=id).
+struct CatalogSnapshot {
+    uint64_t version;
+    Catalog catalog;
+    unordered_map<int, size_t> index; // id -> slot
+    vector<size_t> byId; // slots em ordem de id; vazio quando o catálogo já está ordenado
+    vector<size_t> byPrice; // slots em ordem de preço (cópia do índice ordenado da Store)
+
+    size_t size() const { return catalog.size(); }
+    size_t slotAt(size_t pos) const { return byId.empty() ? pos : byId[pos]; }
+    ProductView at(size_t pos) const { return catalog.view(slotAt(pos)); }
+
+    // posição do primeiro produto com id > afterId
+    size_t positionAfter(int afterId) const {
+        size_t lo = 0, hi = size();
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (catalog.id(slotAt(mid)) <= afterId) lo = mid + 1; else hi = mid;
+        }
+        return lo;
+    }
+
+    // intervalo [first, last) de byPrice com minPrice <= preço <= maxPrice, em O(log n)
+    pair<size_t, size_t> priceRange(double minPrice, double maxPrice) const {
+        auto price = [&](size_t slot){ return catalog.price(slot); };
+        auto first = lower_bound(byPrice.begin(), byPrice.end(), minPrice, [&](size_t slot, double v){ return price(slot) < v; });
+        auto last = upper_bound(first, byPrice.end(), maxPrice, [&](double v, size_t slot){ return v < price(slot); });
+        return {size_t(first - byPrice.begin()), size_t(last - byPrice.begin())};
+    }
+};
+
 class Store {
+public:
+    // Como placeOrder serializa pedidos concorrentes (escolhido na inicialização):
+    // Atomic  - só CAS por produto, com devolução se algum item falhar (padrão)
+    // Global  - um mutex para todos os pedidos
+    // Striped - mutexes por faixa de produtos, adquiridos em ordem crescente (sem deadlock);
+    //           pedidos com produtos disjuntos fecham em paralelo
+    // Em todos os modos a retirada é feita por CAS, então o estoque nunca fica negativo.
+    enum class StockLocking { Atomic, Global, Striped };
 private:
-    vector<Product> products;
-    int nextOrderId = 1;
-    mutex mtx; // proteção concorrência
+    static constexpr size_t Stripes = 256;
+    struct alignas(64) Stripe { mutex mtx; };
+
+    Catalog catalog;
+    unordered_map<int, size_t> index; // id -> slot no catálogo (busca O(1))
+    SearchIndex searchIndex; // nome/descrição -> slots
+    set<pair<double, size_t>> priceIndex; // (preço, slot) em ordem; empates pela ordem de inclusão
+    // lock shared: leituras e pedidos (o estoque é atômico); lock unique: só inclusão de produtos,
+    // que pode realocar as colunas do catálogo
+    shared_mutex mtx;
+    atomic<uint64_t> version{0}; // incrementada a cada mudança no catálogo ou estoque
+    atomic<uint64_t> structureVersion{0}; // incrementada só quando entram produtos
+    shared_ptr<const CatalogSnapshot> published; // acessado só via atomic_load/atomic_store
+    atomic<const CatalogSnapshot*> current{nullptr}; // o mesmo objeto, lido sob EpochManager::Guard
+    mutex publishMtx; // uma cópia por vez; os demais leitores seguem com a versão anterior
+    // Publicador: depois de inclusões, uma thread própria copia o catálogo e publica a
+    // nova versão, então leitores não dependem de alguém chamar snapshot(). Inclusões
+    // em rajada são agrupadas numa única cópia.
+    thread publisher;
+    mutex publisherMtx;
+    condition_variable publisherCv;
+    bool stale = false, stopping = false;
+    StockLocking locking;
+    mutex orderMtx; // modo Global
+    Stripe stripes[Stripes]; // modo Striped
+
+    static size_t stripeOf(int productId) { return size_t((uint64_t(uint32_t(productId)) * 0x9E3779B97F4A7C15ull) >> 56); }
+    static_assert(Stripes == 256, "stripeOf usa os 8 bits mais altos");
+
+    template <typename F>
+    static bool visit(const CatalogSnapshot &snap, int id, F &f) {
+        auto it = snap.index.find(id);
+        if (it == snap.index.end()) return false;
+        f(snap.catalog.view(it->second));
+        return true;
+    }
+
+    // chamar com mtx já adquirido (shared ou unique)
+    optional<size_t> lookup(int id) const {
+        auto it = index.find(id);
+        if (it == index.end()) return nullopt;
+        return it->second;
+    }
+
+    // Cópia da versão atual, com publishMtx já adquirido. Se já estiver publicada, nada é feito.
+    shared_ptr<const CatalogSnapshot> rebuild() {
+        auto snap = atomic_load(&published);
+        if (snap && snap->version == structureVersion.load(memory_order_acquire)) return snap;
+        shared_lock<shared_mutex> lock(mtx);
+        auto fresh = make_shared<CatalogSnapshot>(CatalogSnapshot{structureVersion.load(memory_order_acquire), catalog, index, {}, {}});
+        fresh->byPrice.reserve(priceIndex.size());
+        for (const auto &e : priceIndex) fresh->byPrice.push_back(e.second); // já ordenado: O(n), sem sort
+        lock.unlock();
+        const auto &ids = fresh->catalog.idColumn();
+        if (!is_sorted(ids.begin(), ids.end())) {
+            fresh->byId.resize(ids.size());
+            for (size_t i = 0; i < ids.size(); ++i) fresh->byId[i] = i;
+            stable_sort(fresh->byId.begin(), fresh->byId.end(), [&](size_t a, size_t b){ return ids[a] < ids[b]; });
+        }
+        auto old = snap;
+        snap = fresh;
+        atomic_store(&published, snap);
+        current.store(snap.get(), memory_order_seq_cst);
+        if (old) EpochManager::instance().retire(old); // leitores sem lock podem ainda estar nele
+        return snap;
+    }
+
+    void runPublisher() {
+        unique_lock<mutex> wait(publisherMtx);
+        while (true) {
+            publisherCv.wait(wait, [&]{ return stale || stopping; });
+            if (stopping) return;
+            stale = false;
+            wait.unlock();
+            { lock_guard<mutex> pub(publishMtx); rebuild(); }
+            wait.lock();
+        }
+    }
 public:
-    Store() = default;
+    explicit Store(StockLocking locking = StockLocking::Atomic): locking(locking) {
+        publisher = thread([this]{ runPublisher(); });
+    }
+    ~Store() {
+        { lock_guard<mutex> lock(publisherMtx); stopping = true; }
+        publisherCv.notify_all();
+        publisher.join();
+    }
 
-    void addProduct(const Product &p) { lock_guard<mutex> lock(mtx); products.push_back(p); }
-    Product* findProductById(int id) { lock_guard<mutex> lock(mtx); for (auto &p : products) if (p.getId()==id) return &p; return nullptr; }
-    vector<Product> listProducts() { lock_guard<mutex> lock(mtx); return products; }
+    void addProduct(const Product &p) {
+        {
+            unique_lock<shared_mutex> lock(mtx);
+            size_t slot = catalog.append(p);
+            index.emplace(p.getId(), slot); // ids repetidos mantêm o primeiro, como na busca linear
+            searchIndex.add(slot, catalog.nameKey(slot), catalog.descriptionKey(slot));
+            priceIndex.emplace(catalog.price(slot), slot);
+            structureVersion.fetch_add(1, memory_order_release);
+            version.fetch_add(1, memory_order_release);
+        }
+        { lock_guard<mutex> lock(publisherMtx); stale = true; }
+        publisherCv.notify_one();
+    }
+
+    // Executa f(ProductView) sem nenhum lock: o snapshot publicado é protegido por
+    // época e não pode ser liberado enquanto f roda. A view não deve sair de f.
+    // Um snapshot antigo continua servindo: produtos não mudam depois de incluídos e o
+    // estoque é compartilhado com o catálogo vivo. Se o snapshot está na versão atual, um
+    // id ausente nele não existe. Só ids incluídos depois da última publicação (a cópia
+    // do publicador ainda em andamento) são procurados no catálogo vivo, com o lock shared.
+    template <typename F>
+    bool withProduct(int id, F f) {
+        {
+            EpochManager::Guard guard;
+            const CatalogSnapshot *snap = current.load(memory_order_seq_cst);
+            if (snap && visit(*snap, id, f)) return true;
+            if (snap && snap->version == structureVersion.load(memory_order_acquire)) return false;
+        }
+        shared_lock<shared_mutex> lock(mtx);
+        auto slot = lookup(id);
+        if (!slot) return false;
+        f(catalog.view(*slot));
+        return true;
+    }
+
+    // busca textual: produtos com todos os termos de query, mais relevantes primeiro
+    vector<pair<int, Product>> search(string_view query, size_t limit) {
+        shared_lock<shared_mutex> lock(mtx);
+        vector<pair<int, Product>> out;
+        for (const auto &h : searchIndex.search(query, limit)) out.emplace_back(h.score, catalog.view(h.slot).toProduct());
+        return out;
+    }
 
-    int generateOrderId() { lock_guard<mutex> lock(mtx); return nextOrderId++; }
+    // versão de catálogo + estoque, para chavear caches de respostas
+    uint64_t currentVersion() const { return version.load(memory_order_acquire); }
+    // só inclusões de produtos; comparável a CatalogSnapshot::version
+    uint64_t currentStructureVersion() const { return structureVersion.load(memory_order_acquire); }
+
+    // Retorna o snapshot da versão atual. Normalmente o publicador já o copiou; se não,
+    // quem chega primeiro copia. Enquanto uma thread copia, as outras recebem o snapshot
+    // anterior em vez de esperar.
+    shared_ptr<const CatalogSnapshot> snapshot() {
+        auto snap = atomic_load(&published);
+        if (snap && snap->version == structureVersion.load(memory_order_acquire)) return snap;
+        unique_lock<mutex> pub(publishMtx, try_to_lock);
+        if (!pub.owns_lock()) {
+            if (snap) return snap;
+            pub.lock(); // primeira cópia: não há versão anterior para servir
+        }
+        return rebuild();
+    }
 
     bool placeOrder(const Order &o, string &err) {
-        lock_guard<mutex> lock(mtx);
-        // verificar estoque
-        for (const auto &it : o.getItems()) {
-            Product *p = nullptr;
-            for (auto &pp : products) if (pp.getId()==it.productId) { p = &pp; break; }
-            if (!p) { err = "Produto não encontrado: " + to_string(it.productId); return false; }
-            if (p->getStock() < it.qty) { err = "Estoque insuficiente para: " + p->getName(); return false; }
-        }
-        // reduzir estoque
-        for (const auto &it : o.getItems()) {
-            for (auto &pp : products) if (pp.getId()==it.productId) { pp.decreaseStock(it.qty); break; }
+        shared_lock<shared_mutex> lock(mtx);
+        return placeOrderLocked(o, err);
+    }
+
+    // vários pedidos com uma única aquisição do lock; errs[i] recebe o erro do pedido i
+    vector<bool> placeOrders(const vector<Order> &batch, vector<string> &errs) {
+        shared_lock<shared_mutex> lock(mtx);
+        vector<bool> ok(batch.size());
+        for (size_t i = 0; i < batch.size(); ++i) ok[i] = placeOrderLocked(batch[i], errs[i]);
+        return ok;
+    }
+
+    // Promoção relâmpago: o estoque do produto passa a ser dividido por núcleo, para que
+    // milhares de compradores simultâneos do mesmo item não disputem um só contador.
+    bool enableFlashSale(int productId) {
+        unique_lock<shared_mutex> lock(mtx);
+        auto slot = lookup(productId);
+        if (!slot) return false;
+        catalog.enableFlashStock(*slot, max(thread::hardware_concurrency(), 1u));
+        return true;
+    }
+
+    // reservas de carrinho: retiram/devolvem estoque fora de um pedido
+    bool reserveStock(int productId, int qty) {
+        shared_lock<shared_mutex> lock(mtx);
+        auto slot = lookup(productId);
+        if (!slot || !catalog.tryTakeStock(*slot, qty)) return false;
+        version.fetch_add(1, memory_order_release);
+        return true;
+    }
+    void releaseStock(int productId, int qty) {
+        shared_lock<shared_mutex> lock(mtx);
+        auto slot = lookup(productId);
+        if (!slot) return;
+        catalog.returnStock(*slot, qty);
+        version.fetch_add(1, memory_order_release);
+    }
+
+    json stats() const {
+        static const char *const names[] = {"atomic", "global", "striped"};
+        return json{{"stockLocking", names[static_cast<int>(locking)]}};
+    }
+
+private:
+    // Aplica o modo de locking e reserva o estoque (o lock shared deve estar adquirido).
+    bool placeOrderLocked(const Order &o, string &err) {
+        if (locking == StockLocking::Global) {
+            lock_guard<mutex> lock(orderMtx);
+            return reserveItems(o, err);
+        }
+        if (locking == StockLocking::Striped) {
+            vector<size_t> ids;
+            ids.reserve(o.getItems().size());
+            for (const auto &it : o.getItems()) ids.push_back(stripeOf(it.productId));
+            sort(ids.begin(), ids.end());
+            ids.erase(unique(ids.begin(), ids.end()), ids.end());
+            vector<unique_lock<mutex>> held;
+            held.reserve(ids.size());
+            for (size_t i : ids) held.emplace_back(stripes[i].mtx); // ordem global fixa: sem deadlock
+            return reserveItems(o, err);
         }
+        return reserveItems(o, err);
+    }
+
+    // Reserva o estoque de todos os itens ou de nenhum: cada item é retirado com CAS e,
+    // se algum falhar, os já retirados são devolvidos. No modo Atomic pedidos com
+    // produtos distintos não disputam nada além do lock shared.
+    // Unidades já reservadas no carrinho (CartItem::reserved) não são retiradas de novo.
+    bool reserveItems(const Order &o, string &err) {
+        const auto &items = o.getItems();
+        auto missing = [](const CartItem &it){ return max(it.qty - it.reserved, 0); };
+        size_t taken = 0;
+        for (; taken < items.size(); ++taken) {
+            const auto &it = items[taken];
+            auto slot = lookup(it.productId);
+            if (!slot) { err = "Produto não encontrado: " + to_string(it.productId); break; }
+            if (missing(it) > 0 && !catalog.tryTakeStock(*slot, missing(it))) { err = "Estoque insuficiente para: " + string(catalog.name(*slot)); break; }
+        }
+        if (taken < items.size()) {
+            for (size_t i = 0; i < taken; ++i) catalog.returnStock(*lookup(items[i].productId), missing(items[i]));
+            return false;
+        }
+        version.fetch_add(1, memory_order_release);
         return true;
     }
 };
 
+// ---------- Cache de respostas pré-serializadas ----------
+// Guarda o corpo já renderizado de uma resposta junto da versão do catálogo que o
+// gerou. Enquanto a versão não muda, requisições repetidas só copiam os bytes.
+class ResponseCache {
+private:
+    struct Entry { uint64_t version; string body; };
+    shared_ptr<const Entry> current; // acessado só via atomic_load/atomic_store
+    mutex renderMtx; // um único render por versão
+    atomic<uint64_t> hits{0}, misses{0};
+
+    static shared_ptr<const string> bodyOf(const shared_ptr<const Entry> &e) { return shared_ptr<const string>(e, &e->body); }
+public:
+    // render() só é chamado em miss e deve produzir o corpo para a versão informada
+    template <typename Render>
+    shared_ptr<const string> get(uint64_t version, Render render) {
+        auto e = atomic_load(&current);
+        if (e && e->version == version) { hits.fetch_add(1, memory_order_relaxed); return bodyOf(e); }
+        lock_guard<mutex> lock(renderMtx);
+        e = atomic_load(&current);
+        if (e && e->version == version) { hits.fetch_add(1, memory_order_relaxed); return bodyOf(e); }
+        misses.fetch_add(1, memory_order_relaxed);
+        auto fresh = make_shared<const Entry>(Entry{version, render()});
+        if (!e || e->version < version) atomic_store(&current, fresh); // nunca regride para versão antiga
+        return bodyOf(fresh);
+    }
+
+    json stats() const { return json{{"hits", hits.load()},{"misses", misses.load()}}; }
+};
+
+// ---------- Geração de ids de pedido ----------
+// Ids de 64 bits sem lock da Store: [41 bits ms desde 2024-01-01][16 bits sequência][6 bits nó].
+// O relógio lógico (ms + sequência) nunca recua e começa no horário atual, então ids
+// seguem únicos após reinícios e crescem aproximadamente com o tempo. Cada thread
+// reserva blocos de ids com um único CAS e os entrega localmente; um bloco cujo
+// horário ficou mais de MaxLagMs atrás do relógio (thread ociosa) é descartado, para
+// que um id emitido depois não fique ordenado antes dos que outras threads já deram.
+// Acima de 65536 ids/ms o relógio lógico adianta-se ao real até a carga cair.
+// Os ids passam de 2^53: no JSON são sempre strings (parse aceita o texto de volta).
+class OrderIdGenerator {
+private:
+    static constexpr int SeqBits = 16, NodeBits = 6;
+    static constexpr uint64_t Block = 256;
+    static constexpr uint64_t MaxLagMs = 1;
+    static constexpr uint64_t EpochMs = 1704067200000ull; // 2024-01-01T00:00:00Z
+    struct ThreadBlock { const OrderIdGenerator *owner = nullptr; uint64_t next = 0, end = 0; };
+
+    uint64_t node;
+    atomic<uint64_t> clock{0}; // último valor lógico reservado (ms << SeqBits | seq)
+
+    static uint64_t nowLogical() {
+        auto ms = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+        return (uint64_t(ms) - EpochMs) << SeqBits;
+    }
+public:
+    static constexpr uint64_t MaxNode = (uint64_t(1) << NodeBits) - 1;
+
+    explicit OrderIdGenerator(uint64_t node = 0): node(node) {
+        if (node > MaxNode) throw invalid_argument("node deve estar entre 0 e " + to_string(MaxNode));
+    }
+
+    // id vindo de query string/JSON; nullopt se não for um número inteiro positivo
+    static optional<int64_t> parse(const string &text) {
+        if (text.empty() || text.size() > 19 || !all_of(text.begin(), text.end(), [](char c){ return isdigit(static_cast<unsigned char>(c)); })) return nullopt;
+        try { int64_t id = stoll(text); if (id > 0) return id; } catch (...) {}
+        return nullopt;
+    }
+
+    int64_t next() {
+        static thread_local ThreadBlock block;
+        uint64_t now = nowLogical();
+        if (block.owner != this || block.next == block.end || block.next + (MaxLagMs << SeqBits) < now) {
+            uint64_t last = clock.load(memory_order_relaxed), start;
+            do { start = max(last, now); }
+            while (!clock.compare_exchange_weak(last, start + Block, memory_order_relaxed));
+            block = ThreadBlock{this, start, start + Block};
+        }
+        return int64_t((block.next++ << NodeBits) | node);
+    }
+};
+
+// ---------- Histórico de pedidos (em memória) ----------
+// Registro append-only dos pedidos fechados. Pedidos e índice por cliente ficam em
+// shards independentes (por id do pedido e por id do cliente), cada um com seu lock:
+// checkouts simultâneos só disputam quando caem no mesmo shard.
+class OrderRepository {
+private:
+    static constexpr size_t Shards = 64;
+    struct alignas(64) OrderShard {
+        mutex mtx;
+        deque<Order> log; // append-only; deque não move os pedidos já gravados
+        unordered_map<int64_t, size_t> byId; // id do pedido -> posição em log
+    };
+    struct alignas(64) CustomerShard {
+        mutex mtx;
+        unordered_map<int, vector<int64_t>> orderIds; // clienteId -> ids dos pedidos, em ordem de gravação
+    };
+    OrderShard orderShards[Shards];
+    CustomerShard customerShards[Shards];
+
+    // hash multiplicativo: os bits baixos do id de pedido (nó) são constantes
+    static size_t shardOf(int64_t key) { return size_t((uint64_t(key) * 0x9E3779B97F4A7C15ull) >> 58); }
+    static_assert(Shards == 64, "shardOf usa os 6 bits mais altos");
+public:
+    void add(const Order &o) {
+        {
+            auto &s = orderShards[shardOf(o.getId())];
+            lock_guard<mutex> lock(s.mtx);
+            s.log.push_back(o);
+            s.byId.emplace(o.getId(), s.log.size() - 1);
+        }
+        auto &c = customerShards[shardOf(o.getCustomerId())];
+        lock_guard<mutex> lock(c.mtx);
+        c.orderIds[o.getCustomerId()].push_back(o.getId());
+    }
+
+    optional<Order> findById(int64_t id) {
+        auto &s = orderShards[shardOf(id)];
+        lock_guard<mutex> lock(s.mtx);
+        auto it = s.byId.find(id);
+        if (it == s.byId.end()) return nullopt;
+        return s.log[it->second];
+    }
+
+    vector<Order> findByCustomer(int customerId) {
+        vector<int64_t> ids;
+        {
+            auto &c = customerShards[shardOf(customerId)];
+            lock_guard<mutex> lock(c.mtx);
+            auto it = c.orderIds.find(customerId);
+            if (it == c.orderIds.end()) return {};
+            ids = it->second;
+        }
+        vector<Order> out;
+        out.reserve(ids.size());
+        for (int64_t id : ids) if (auto o = findById(id)) out.push_back(move(*o));
+        return out;
+    }
+};
+
+// ---------- Temporizadores (roda hierárquica) ----------
+// Dois níveis: 256 posições de 1 tick e 64 posições de 256 ticks (até 16383 ticks à
+// frente). Agendar, cancelar e expirar custam O(1) por temporizador; a cada 256 ticks
+// uma posição do nível de cima é redistribuída no de baixo. Sem lock próprio.
+template <typename Key>
+class TimerWheel {
+private:
+    struct Node { Key key; uint64_t deadline; Node *prev; Node *next; Node **head; };
+    Node *level0[256] = {};
+    Node *level1[64] = {};
+    uint64_t tick = 0;
+
+    void place(Node *n) {
+        uint64_t delta = n->deadline - tick;
+        Node **head = delta < 256 ? &level0[n->deadline & 255] : &level1[(n->deadline >> 8) & 63];
+        n->head = head;
+        n->prev = nullptr;
+        n->next = *head;
+        if (*head) (*head)->prev = n;
+        *head = n;
+    }
+    void unlink(Node *n) {
+        if (n->prev) n->prev->next = n->next; else *n->head = n->next;
+        if (n->next) n->next->prev = n->prev;
+    }
+    static void freeList(Node *n) { while (n) { Node *next = n->next; delete n; n = next; } }
+public:
+    using Handle = Node*;
+    static constexpr uint64_t MaxDelay = 256 * 64 - 1;
+
+    TimerWheel() = default;
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+    ~TimerWheel() { for (Node *n : level0) freeList(n); for (Node *n : level1) freeList(n); }
+
+    uint64_t now() const { return tick; }
+
+    Handle schedule(uint64_t delay, Key key) {
+        Node *n = new Node{key, tick + min(max<uint64_t>(delay, 1), MaxDelay), nullptr, nullptr, nullptr};
+        place(n);
+        return n;
+    }
+    void cancel(Handle n) { unlink(n); delete n; }
+
+    // avança ticks chamando onExpire(key) para cada temporizador vencido
+    template <typename F>
+    void advance(uint64_t ticks, F onExpire) {
+        while (ticks--) {
+            ++tick;
+            if ((tick & 255) == 0) {
+                Node *n = level1[(tick >> 8) & 63];
+                level1[(tick >> 8) & 63] = nullptr;
+                while (n) { Node *next = n->next; place(n); n = next; }
+            }
+            Node *n = level0[tick & 255];
+            level0[tick & 255] = nullptr;
+            while (n) { Node *next = n->next; Key key = n->key; delete n; onExpire(key); n = next; }
+        }
+    }
+};
+
+// ---------- Itens de carrinho compactos ----------
+// Vetor com os primeiros N elementos dentro do próprio objeto; só carrinhos maiores
+// alocam no heap. Restrito a tipos trivialmente copiáveis (cópia por atribuição simples).
+template <typename T, size_t N>
+class SmallVector {
+    static_assert(is_trivially_copyable<T>::value, "SmallVector só guarda tipos trivialmente copiáveis");
+private:
+    uint32_t count = 0, cap = N;
+    union { T local[N]; T *heap; };
+
+    T* data() { return cap > N ? heap : local; }
+    const T* data() const { return cap > N ? heap : local; }
+    void grow() {
+        T *p = new T[size_t(cap) * 2];
+        copy(begin(), end(), p);
+        if (cap > N) delete[] heap;
+        heap = p;
+        cap *= 2;
+    }
+public:
+    SmallVector() {}
+    SmallVector(const SmallVector &o) { for (const T &x : o) push_back(x); }
+    SmallVector& operator=(const SmallVector &o) {
+        if (this != &o) { count = 0; for (const T &x : o) push_back(x); }
+        return *this;
+    }
+    ~SmallVector() { if (cap > N) delete[] heap; }
+
+    size_t size() const { return count; }
+    size_t capacity() const { return cap; }
+    bool empty() const { return count == 0; }
+    bool onHeap() const { return cap > N; }
+    void push_back(const T &x) { if (count == cap) grow(); data()[count++] = x; }
+    void erase(T *pos) { copy(pos + 1, end(), pos); --count; }
+    T& back() { return data()[count - 1]; }
+    T* begin() { return data(); }
+    T* end() { return data() + count; }
+    const T* begin() const { return data(); }
+    const T* end() const { return data() + count; }
+};
+
+// Item de carrinho como fica guardado na sessão: 24 bytes, nome compartilhado via
+// NameInterner. CartItem (com o nome copiado) só é montado na saída, para o pedido.
+struct CartEntry {
+    double unitPrice; // preço no momento da inclusão
+    int productId;
+    int qty;
+    int reserved; // unidades já retiradas do estoque por uma reserva de carrinho
+    uint32_t nameId; // NameInterner
+
+    const string& productName() const { return NameInterner::instance().name(nameId); }
+    int64_t unitCents() const { return toCents(unitPrice); }
+    double subtotal() const { return fromCents(unitCents() * qty); }
+    CartItem toItem() const { return CartItem{productId, productName(), unitPrice, qty, reserved}; }
+    json toJson() const {
+        json j{{"productId", productId},{"productName", productName()},{"unitPrice", unitPrice},{"qty", qty},{"subtotal", subtotal()}};
+        if (reserved > 0) j["reserved"] = reserved;
+        return j;
+    }
+};
+
 // ---------- Sessão simples por cliente (em memória) ----------
 // A API vai manter "carrinhos" por clienteId (simples map). Em produção, use autenticação.
-#include <unordered_map>
+// Com reservas habilitadas, addToCart já retira o estoque da Store (CartItem::reserved)
+// e um temporizador devolve a reserva se o carrinho não fechar dentro do TTL.
+// Os carrinhos ficam em shards por hash do clienteId, cada um com lock, carrinhos e
+// temporizadores próprios: clientes diferentes só se bloqueiam se caírem no mesmo shard.
+// Carrinhos abandonados saem por inatividade (idle TTL) ou, acima do limite de memória,
+// pelo mais antigo de uma amostra (LRU aproximado). Essa limpeza roda só na thread do
+// ticker; as requisições apenas carimbam o último acesso, com o lock do shard que já têm.
 class SessionManager {
+public:
+    static constexpr size_t InlineItems = 4; // itens guardados dentro do próprio carrinho
+    static constexpr int64_t MaxReservationTtl = TimerWheel<uint64_t>::MaxDelay; // segundos (alcance da roda)
+    using CartItems = SmallVector<CartEntry, InlineItems>;
+    // mantidos a cada alteração do carrinho: lê-los não percorre os itens (subtotal em centavos)
+    struct CartTotals {
+        int64_t subtotalCents = 0;
+        int units = 0;
+        double subtotal() const { return fromCents(subtotalCents); }
+    };
+    enum class UpdateResult { Ok, NotInCart, OutOfStock, CheckoutPending };
+    enum class ClaimResult { Ok, Empty, CheckoutPending };
 private:
-    unordered_map<int, vector<CartItem>> carts; // clienteId -> cart items
-    mutex mtx;
+    using Wheel = TimerWheel<uint64_t>;
+    struct Cart {
+        CartItems items;
+        CartTotals totals;
+        uint32_t lastAccess = 0; // segundos do relógio do ticker
+        uint32_t bytes : 31; // estimativa de memória, contada em Shard::bytes
+        uint32_t checkoutPending : 1; // itens reivindicados por um checkout ainda sem resultado
+        Cart(): bytes(0), checkoutPending(0) {}
+    };
+    struct alignas(64) Shard {
+        mutex mtx;
+        unordered_map<int, Cart> carts; // clienteId -> carrinho
+        Wheel wheel; // reservas deste shard (1 tick = 1 s)
+        unordered_map<uint64_t, Wheel::Handle> timers; // (cliente, produto) -> temporizador
+        atomic<size_t> bytes{0}; // escrito com mtx; lido sem lock pelo ticker e por stats()
+    };
+    size_t shardCount;
+    unique_ptr<Shard[]> shards;
+
+    // reservas (opcionais)
+    Store *store = nullptr;
+    uint64_t ttlTicks = 0;
+    atomic<uint64_t> expired{0};
+
+    // despejo de carrinhos (opcional)
+    uint32_t idleTtl = 0; // segundos; 0 = sem expiração por inatividade
+    size_t maxBytes = 0; // 0 = sem limite de memória
+    atomic<uint32_t> clock{0}; // segundos desde o início, avançado pelo ticker
+    atomic<uint64_t> idleEvictions{0}, memoryEvictions{0};
+
+    thread ticker;
+    mutex tickerMtx;
+    condition_variable tickerCv;
+    bool stopping = false;
+
+    Shard& shardOf(int customerId) {
+        // hash multiplicativo: ids sequenciais se espalham entre os shards
+        return shards[((uint64_t(uint32_t(customerId)) * 0x9E3779B97F4A7C15ull) >> 32) % shardCount];
+    }
+    static uint64_t keyOf(int customerId, int productId) { return (uint64_t(uint32_t(customerId)) << 32) | uint32_t(productId); }
+
+    // memória aproximada de um carrinho: nó do mapa e itens que não couberam nele
+    // (os nomes são compartilhados e não entram na conta)
+    static uint32_t bytesOf(const CartItems &items) {
+        size_t b = sizeof(pair<const int, Cart>) + 2 * sizeof(void*);
+        if (items.onHeap()) b += items.capacity() * sizeof(CartEntry);
+        return uint32_t(b);
+    }
+
+    // as funções abaixo são chamadas com s.mtx adquirido
+    void touch(Shard &s, Cart &cart) {
+        cart.lastAccess = clock.load(memory_order_relaxed);
+        uint32_t b = bytesOf(cart.items);
+        s.bytes.store(s.bytes.load(memory_order_relaxed) + b - cart.bytes, memory_order_relaxed);
+        cart.bytes = b;
+    }
+    void arm(Shard &s, int customerId, int productId) {
+        uint64_t key = keyOf(customerId, productId);
+        auto it = s.timers.find(key);
+        if (it != s.timers.end()) s.wheel.cancel(it->second);
+        s.timers[key] = s.wheel.schedule(ttlTicks, key);
+    }
+    void disarm(Shard &s, int customerId, int productId) {
+        auto it = s.timers.find(keyOf(customerId, productId));
+        if (it == s.timers.end()) return;
+        s.wheel.cancel(it->second);
+        s.timers.erase(it);
+    }
+    void expire(Shard &s, uint64_t key) {
+        s.timers.erase(key);
+        int customerId = int(uint32_t(key >> 32)), productId = int(uint32_t(key));
+        auto c = s.carts.find(customerId);
+        if (c == s.carts.end()) return;
+        for (auto &ci : c->second.items) if (ci.productId == productId && ci.reserved > 0) {
+            store->releaseStock(productId, ci.reserved);
+            ci.reserved = 0;
+            expired.fetch_add(1, memory_order_relaxed);
+        }
+    }
+    // remove o carrinho devolvendo as reservas que ainda estiverem nele
+    void drop(Shard &s, unordered_map<int, Cart>::iterator c) {
+        for (const auto &ci : c->second.items) if (ci.reserved > 0) { disarm(s, c->first, ci.productId); store->releaseStock(ci.productId, ci.reserved); }
+        s.bytes.store(s.bytes.load(memory_order_relaxed) - c->second.bytes, memory_order_relaxed);
+        s.carts.erase(c);
+    }
+    void evictIdle(Shard &s, uint32_t now) {
+        for (auto c = s.carts.begin(); c != s.carts.end();) {
+            auto next = std::next(c);
+            if (now - c->second.lastAccess > idleTtl) { drop(s, c); idleEvictions.fetch_add(1, memory_order_relaxed); }
+            c = next;
+        }
+    }
+
+    size_t residentBytes() const {
+        size_t total = 0;
+        for (size_t i = 0; i < shardCount; ++i) total += shards[i].bytes.load(memory_order_relaxed);
+        return total;
+    }
+    // LRU aproximado: sorteia alguns carrinhos de um shard e despeja o de acesso mais antigo,
+    // até a memória voltar ao limite (no máximo 65536 despejos por tick)
+    void evictToCap(uint64_t &rng) {
+        const size_t Samples = 5, MaxPerTick = 65536;
+        for (size_t n = 0; n < MaxPerTick && residentBytes() > maxBytes; ++n) {
+            rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17; // xorshift64
+            Shard &s = shards[rng % shardCount];
+            lock_guard<mutex> lock(s.mtx);
+            if (s.carts.empty()) continue;
+            auto victim = s.carts.end();
+            size_t buckets = s.carts.bucket_count();
+            for (size_t k = 0, probes = 0; k < Samples && probes < 4 * buckets; ++probes) {
+                size_t b = (rng >> 16) % buckets;
+                rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+                if (s.carts.bucket_size(b) == 0) continue;
+                auto it = s.carts.find(s.carts.begin(b)->first);
+                if (victim == s.carts.end() || it->second.lastAccess < victim->second.lastAccess) victim = it;
+                ++k;
+            }
+            if (victim == s.carts.end()) continue;
+            drop(s, victim);
+            memoryEvictions.fetch_add(1, memory_order_relaxed);
+        }
+    }
+
+    void runTicker() {
+        auto start = chrono::steady_clock::now();
+        uint64_t rng = 0x9E3779B97F4A7C15ull;
+        unique_lock<mutex> wait(tickerMtx);
+        while (!tickerCv.wait_for(wait, chrono::seconds(1), [&]{ return stopping; })) {
+            uint64_t elapsed = chrono::duration_cast<chrono::seconds>(chrono::steady_clock::now() - start).count();
+            clock.store(uint32_t(elapsed), memory_order_relaxed);
+            for (size_t i = 0; i < shardCount; ++i) { // um shard por vez: os demais seguem atendendo
+                Shard &s = shards[i];
+                lock_guard<mutex> lock(s.mtx);
+                if (store && elapsed > s.wheel.now()) s.wheel.advance(elapsed - s.wheel.now(), [&](uint64_t key){ expire(s, key); });
+                if (idleTtl) evictIdle(s, uint32_t(elapsed));
+            }
+            if (maxBytes) evictToCap(rng);
+        }
+    }
+    void startTicker() { if (!ticker.joinable()) ticker = thread([this]{ runTicker(); }); }
 public:
-    void addToCart(int customerId, const CartItem &item) {
-        lock_guard<mutex> lock(mtx);
-        auto &cart = carts[customerId];
+    // 0 = 4 shards por núcleo, para que colisões entre clientes ativos sejam raras
+    explicit SessionManager(size_t shardCount = 0)
+        : shardCount(shardCount ? shardCount : 4 * max(thread::hardware_concurrency(), 1u)), shards(new Shard[this->shardCount]) {}
+    ~SessionManager() {
+        { lock_guard<mutex> lock(tickerMtx); stopping = true; }
+        tickerCv.notify_all();
+        if (ticker.joinable()) ticker.join();
+    }
+
+    // liga as reservas de estoque no carrinho (chamar antes de atender requisições)
+    void enableReservations(Store &s, chrono::seconds ttl) {
+        if (ttl.count() < 1 || ttl.count() > MaxReservationTtl) throw out_of_range("TTL de reserva deve estar entre 1 e " + to_string(MaxReservationTtl) + " s");
+        store = &s;
+        ttlTicks = uint64_t(ttl.count());
+        startTicker();
+    }
+    // liga o despejo de carrinhos: idle = inatividade máxima (0 = sem), bytes = teto de memória (0 = sem)
+    void enableEviction(chrono::seconds idle, size_t bytes) {
+        idleTtl = uint32_t(max<int64_t>(idle.count(), 0));
+        maxBytes = bytes;
+        if (idleTtl || maxBytes) startTicker();
+    }
+
+    // false (com err) se a reserva de estoque não puder ser feita
+    // item.nameId vem do Catalog (ProductView::getNameId); item.reserved é ignorado
+    bool addToCart(int customerId, const CartEntry &item, string &err) {
+        Shard &s = shardOf(customerId);
+        lock_guard<mutex> lock(s.mtx);
+        if (store && !store->reserveStock(item.productId, item.qty)) { err = "Estoque insuficiente para: " + item.productName(); return false; }
+        auto &cart = s.carts[customerId];
+        if (store) arm(s, customerId, item.productId); // cada inclusão renova o TTL da reserva
+        int reserved = store ? item.qty : 0;
         // mesclar se existir
-        for (auto &ci : cart) if (ci.productId==item.productId) { ci.qty += item.qty; return; }
-        cart.push_back(item);
+        bool merged = false;
+        for (auto &ci : cart.items) if (ci.productId==item.productId) {
+            ci.qty += item.qty; ci.reserved += reserved; merged = true;
+            cart.totals.subtotalCents += ci.unitCents() * item.qty; // preço da primeira inclusão, como em subtotal()
+            break;
+        }
+        if (!merged) {
+            cart.items.push_back(CartEntry{item.unitPrice, item.productId, item.qty, reserved, item.nameId});
+            cart.totals.subtotalCents += item.unitCents() * item.qty;
+        }
+        cart.totals.units += item.qty;
+        touch(s, cart);
+        return true;
+    }
+
+    // Nova quantidade de um item (0 remove). Com reservas, aumentar reserva a diferença
+    // e diminuir devolve o que passar da nova quantidade; carrinho vazio é descartado.
+    UpdateResult updateCartItem(int customerId, int productId, int qty, string &err) {
+        Shard &s = shardOf(customerId);
+        lock_guard<mutex> lock(s.mtx);
+        auto c = s.carts.find(customerId);
+        CartEntry *ci = nullptr;
+        if (c != s.carts.end()) for (auto &x : c->second.items) if (x.productId == productId) { ci = &x; break; }
+        if (!ci) { err = "Produto não está no carrinho"; return UpdateResult::NotInCart; }
+        Cart &cart = c->second;
+        if (cart.checkoutPending) { err = "Checkout deste carrinho em andamento"; return UpdateResult::CheckoutPending; }
+        int delta = qty - ci->qty;
+        if (store && delta > 0) {
+            if (!store->reserveStock(productId, delta)) { err = "Estoque insuficiente para: " + ci->productName(); return UpdateResult::OutOfStock; }
+            ci->reserved += delta;
+            arm(s, customerId, productId);
+        } else if (store && ci->reserved > qty) {
+            store->releaseStock(productId, ci->reserved - qty);
+            ci->reserved = qty;
+            if (qty == 0) disarm(s, customerId, productId);
+        }
+        cart.totals.subtotalCents += ci->unitCents() * delta;
+        cart.totals.units += delta;
+        if (qty > 0) ci->qty = qty;
+        else cart.items.erase(ci);
+        if (cart.items.empty()) { drop(s, c); return UpdateResult::Ok; }
+        touch(s, cart);
+        return UpdateResult::Ok;
+    }
+
+    // Leitura sem cópia: f(const CartItems&, const CartTotals&) roda com o lock do shard, então deve
+    // ser curta e não chamar o SessionManager. Cliente sem carrinho: false, f não é chamada
+    // e nada é criado (ids desconhecidos não ocupam memória).
+    template <typename F>
+    bool withCart(int customerId, F &&f) {
+        Shard &s = shardOf(customerId);
+        lock_guard<mutex> lock(s.mtx);
+        auto it = s.carts.find(customerId);
+        if (it == s.carts.end()) return false;
+        it->second.lastAccess = clock.load(memory_order_relaxed);
+        f(static_cast<const CartItems&>(it->second.items), static_cast<const CartTotals&>(it->second.totals));
+        return true;
+    }
+
+    // Cópia do carrinho para o checkout. As reservas passam a pertencer ao chamador
+    // (os temporizadores são cancelados) e o carrinho fica marcado até o resultado:
+    // em sucesso finishClaim retira os itens pedidos; em falha restoreReservations
+    // devolve as reservas. Enquanto isso, outro checkout do mesmo cliente recebe
+    // CheckoutPending. subtotal (opcional) recebe o total mantido do carrinho, em O(1):
+    // somado nos mesmos centavos que Order::calculateTotal, bate com as linhas do pedido.
+    ClaimResult claimCart(int customerId, vector<CartItem> &out, double *subtotal = nullptr) {
+        Shard &s = shardOf(customerId);
+        lock_guard<mutex> lock(s.mtx);
+        auto it = s.carts.find(customerId);
+        if (it == s.carts.end() || it->second.items.empty()) return ClaimResult::Empty;
+        Cart &cart = it->second;
+        if (cart.checkoutPending) return ClaimResult::CheckoutPending;
+        cart.lastAccess = clock.load(memory_order_relaxed);
+        cart.checkoutPending = 1;
+        out.clear();
+        out.reserve(cart.items.size());
+        for (const auto &e : cart.items) out.push_back(e.toItem());
+        if (subtotal) *subtotal = cart.totals.subtotal();
+        for (auto &ci : cart.items) if (ci.reserved > 0) { disarm(s, customerId, ci.productId); ci.reserved = 0; }
+        return ClaimResult::Ok;
+    }
+    // Checkout concluído: retira do carrinho só o que foi reivindicado. Itens e quantidades
+    // incluídos depois do claim (com suas reservas) continuam no carrinho.
+    void finishClaim(int customerId, const vector<CartItem> &claimed) {
+        Shard &s = shardOf(customerId);
+        lock_guard<mutex> lock(s.mtx);
+        auto c = s.carts.find(customerId);
+        if (c == s.carts.end()) return; // despejado nesse meio-tempo
+        Cart &cart = c->second;
+        cart.checkoutPending = 0;
+        for (const auto &it : claimed) {
+            CartEntry *ci = nullptr;
+            for (auto &x : cart.items) if (x.productId == it.productId) { ci = &x; break; }
+            if (!ci) continue;
+            int taken = min(it.qty, ci->qty);
+            cart.totals.subtotalCents -= ci->unitCents() * taken;
+            cart.totals.units -= taken;
+            ci->qty -= taken;
+            if (ci->qty > 0) continue;
+            if (ci->reserved > 0) { disarm(s, customerId, ci->productId); store->releaseStock(ci->productId, ci->reserved); }
+            cart.items.erase(ci);
+        }
+        if (cart.items.empty()) drop(s, c);
+        else touch(s, cart);
+    }
+    // Checkout falhou: o carrinho volta a aceitar checkout e recebe as reservas de volta.
+    // Se tiver sido despejado nesse meio-tempo, o estoque volta para a Store.
+    void restoreReservations(int customerId, const vector<CartItem> &items) {
+        Shard &s = shardOf(customerId);
+        lock_guard<mutex> lock(s.mtx);
+        auto c = s.carts.find(customerId);
+        if (c != s.carts.end()) c->second.checkoutPending = 0;
+        if (!store) return;
+        for (const auto &it : items) {
+            if (it.reserved <= 0) continue;
+            CartEntry *ci = nullptr;
+            if (c != s.carts.end()) for (auto &x : c->second.items) if (x.productId == it.productId) { ci = &x; break; }
+            if (!ci) { store->releaseStock(it.productId, it.reserved); continue; }
+            ci->reserved += it.reserved;
+            arm(s, customerId, it.productId);
+        }
+    }
+
+    json stats() const {
+        return json{{"shards", shardCount},{"internedNames", NameInterner::instance().size()},{"reservations", store != nullptr},{"reservationsExpired", expired.load()},
+                    {"residentBytes", residentBytes()},{"idleEvictions", idleEvictions.load()},{"memoryEvictions", memoryEvictions.load()}};
+    }
+};
+
+// ---------- Checkout (direto ou combinado) ----------
+// No modo combining, pedidos simultâneos entram numa pilha sem lock; a thread que
+// conseguir o papel de combinadora processa o lote inteiro com uma única aquisição
+// do lock da Store (flat combining), e as demais só aguardam o próprio resultado.
+class CheckoutProcessor {
+public:
+    enum class Mode { Direct, Combining };
+private:
+    struct Request {
+        int customerId;
+        const vector<CartItem> *items;
+        int64_t orderId; // 0 = gerar na combinação
+        optional<double> total; // subtotal já conhecido do carrinho
+        Order order;
+        string err;
+        bool ok = false;
+        atomic<bool> done{false};
+        Request *next = nullptr;
+    };
+    Store &store;
+    OrderIdGenerator &ids;
+    Mode mode;
+    atomic<Request*> pending{nullptr};
+    mutex combinerMtx;
+    atomic<uint64_t> batches{0}, combined{0};
+
+    void combine(Request *head) {
+        vector<Request*> batch;
+        for (Request *r = head; r; r = r->next) batch.push_back(r);
+        reverse(batch.begin(), batch.end()); // ordem de chegada
+        vector<Order> batchOrders;
+        batchOrders.reserve(batch.size());
+        for (Request *r : batch) {
+            int64_t id = r->orderId ? r->orderId : ids.next();
+            if (r->total) batchOrders.emplace_back(id, *r->items, r->customerId, *r->total);
+            else batchOrders.emplace_back(id, *r->items, r->customerId);
+        }
+        vector<string> errs(batch.size());
+        vector<bool> ok = store.placeOrders(batchOrders, errs);
+        batches.fetch_add(1, memory_order_relaxed);
+        combined.fetch_add(batch.size(), memory_order_relaxed);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            Request *r = batch[i];
+            r->order = move(batchOrders[i]);
+            r->err = move(errs[i]);
+            r->ok = ok[i];
+            r->done.store(true, memory_order_release); // depois disso r pode deixar de existir
+        }
+    }
+public:
+    CheckoutProcessor(Store &store, OrderIdGenerator &ids, Mode mode): store(store), ids(ids), mode(mode) {}
+
+    // orderId != 0 usa um id já reservado (checkout assíncrono); total, se vier, dispensa somar os itens
+    bool place(int customerId, const vector<CartItem> &items, Order &out, string &err, int64_t orderId = 0, optional<double> total = nullopt) {
+        if (mode == Mode::Direct) {
+            int64_t id = orderId ? orderId : ids.next();
+            out = total ? Order(id, items, customerId, *total) : Order(id, items, customerId);
+            return store.placeOrder(out, err);
+        }
+        Request r;
+        r.customerId = customerId;
+        r.items = &items;
+        r.orderId = orderId;
+        r.total = total;
+        r.next = pending.load(memory_order_relaxed);
+        while (!pending.compare_exchange_weak(r.next, &r, memory_order_release, memory_order_relaxed)) {}
+        while (!r.done.load(memory_order_acquire)) {
+            if (combinerMtx.try_lock()) {
+                Request *head = pending.exchange(nullptr, memory_order_acquire);
+                if (head) combine(head);
+                combinerMtx.unlock();
+            } else {
+                this_thread::yield();
+            }
+        }
+        out = move(r.order);
+        err = move(r.err);
+        return r.ok;
+    }
+
+    // Lote explícito (POST /checkout/batch): todos os pedidos numa só passada pela Store.
+    // out[i]/errs[i] correspondem a carts[i] = (customerId, itens).
+    vector<bool> placeBatch(const vector<pair<int, vector<CartItem>>> &carts, vector<Order> &out, vector<string> &errs) {
+        out.clear();
+        out.reserve(carts.size());
+        for (const auto &c : carts) out.emplace_back(ids.next(), c.second, c.first);
+        errs.assign(carts.size(), string());
+        batches.fetch_add(1, memory_order_relaxed);
+        combined.fetch_add(carts.size(), memory_order_relaxed);
+        return store.placeOrders(out, errs);
+    }
+
+    json stats() const {
+        uint64_t b = batches.load(), n = combined.load();
+        return json{{"mode", mode == Mode::Direct ? "direct" : "combining"},{"batches", b},{"orders", n},{"avgBatch", b ? double(n) / b : 0.0}};
+    }
+};
+
+// ---------- Checkout assíncrono ----------
+// Fila limitada (produtores: threads HTTP; consumidores: workers de checkout).
+// tryPush não bloqueia: fila cheia é respondida na hora, sem segurar a thread HTTP.
+template <typename T>
+class BoundedQueue {
+private:
+    deque<T> items;
+    size_t capacity;
+    bool closed = false;
+    mutex mtx;
+    condition_variable notEmpty;
+public:
+    explicit BoundedQueue(size_t capacity): capacity(capacity) {}
+
+    bool tryPush(T item) {
+        {
+            lock_guard<mutex> lock(mtx);
+            if (closed || items.size() >= capacity) return false;
+            items.push_back(move(item));
+        }
+        notEmpty.notify_one();
+        return true;
+    }
+    // bloqueia até haver item; nullopt quando a fila foi fechada e esvaziada
+    optional<T> pop() {
+        unique_lock<mutex> lock(mtx);
+        notEmpty.wait(lock, [&]{ return closed || !items.empty(); });
+        if (items.empty()) return nullopt;
+        T item = move(items.front());
+        items.pop_front();
+        return item;
+    }
+    void close() {
+        { lock_guard<mutex> lock(mtx); closed = true; }
+        notEmpty.notify_all();
+    }
+    size_t size() { lock_guard<mutex> lock(mtx); return items.size(); }
+};
+
+// Com checkout assíncrono, /checkout só valida, reserva um id e enfileira; workers
+// dedicados rodam o checkout e o cliente acompanha por GET /checkout/status.
+// Pedidos concluídos saem da tabela de status e passam a ser achados no OrderRepository.
+class AsyncCheckout {
+public:
+    enum class State { Pending, Done, Failed, Unknown };
+private:
+    struct Job { int64_t orderId; int customerId; vector<CartItem> items; optional<double> total; };
+    CheckoutProcessor &checkout;
+    OrderRepository &orders;
+    SessionManager &sessions;
+    BoundedQueue<Job> queue;
+    struct Status { bool failed = false; string err; };
+    using Clock = chrono::steady_clock;
+    static constexpr size_t MaxFailures = 10000; // falhas guardadas para consulta
+    static constexpr chrono::hours FailureTtl{1};
+    mutex statusMtx;
+    unordered_map<int64_t, Status> unfinished; // pendentes e falhos
+    deque<pair<int64_t, Clock::time_point>> failures; // ordem das falhas, para expirá-las
+    vector<thread> workers;
+
+    // chamar com statusMtx adquirido
+    void recordFailure(int64_t orderId, string err) {
+        auto now = Clock::now();
+        unfinished[orderId] = Status{true, move(err)};
+        failures.emplace_back(orderId, now);
+        while (failures.size() > MaxFailures || failures.front().second + FailureTtl <= now) {
+            unfinished.erase(failures.front().first);
+            failures.pop_front();
+        }
+    }
+
+    void work() {
+        while (auto job = queue.pop()) {
+            Order order;
+            string err;
+            if (checkout.place(job->customerId, job->items, order, err, job->orderId, job->total)) {
+                orders.add(order); // antes de sair da tabela: o status nunca some
+                sessions.finishClaim(job->customerId, job->items);
+                lock_guard<mutex> lock(statusMtx);
+                unfinished.erase(job->orderId);
+            } else {
+                sessions.restoreReservations(job->customerId, job->items);
+                lock_guard<mutex> lock(statusMtx);
+                recordFailure(job->orderId, err);
+            }
+        }
+    }
+public:
+    AsyncCheckout(CheckoutProcessor &checkout, OrderRepository &orders, SessionManager &sessions, size_t workerCount, size_t capacity)
+        : checkout(checkout), orders(orders), sessions(sessions), queue(capacity) {
+        for (size_t i = 0; i < workerCount; ++i) workers.emplace_back([this]{ work(); });
+    }
+    ~AsyncCheckout() {
+        queue.close();
+        for (auto &w : workers) w.join();
+    }
+
+    // false se a fila estiver cheia (o chamador continua dono do carrinho)
+    bool submit(int64_t orderId, int customerId, vector<CartItem> items, optional<double> total = nullopt) {
+        {
+            lock_guard<mutex> lock(statusMtx);
+            unfinished[orderId] = Status();
+        }
+        if (queue.tryPush(Job{orderId, customerId, move(items), total})) return true;
+        lock_guard<mutex> lock(statusMtx);
+        unfinished.erase(orderId);
+        return false;
+    }
+
+    // estado do pedido; err recebe o motivo quando Failed
+    State status(int64_t orderId, string &err) {
+        {
+            lock_guard<mutex> lock(statusMtx);
+            auto it = unfinished.find(orderId);
+            if (it != unfinished.end()) {
+                if (!it->second.failed) return State::Pending;
+                err = it->second.err;
+                return State::Failed;
+            }
+        }
+        return orders.findById(orderId) ? State::Done : State::Unknown;
+    }
+
+    json stats() {
+        size_t failed;
+        { lock_guard<mutex> lock(statusMtx); failed = failures.size(); }
+        return json{{"workers", workers.size()},{"queued", queue.size()},{"failedKept", failed}};
+    }
+};
+
+// ---------- Idempotência do checkout ----------
+// Respostas de /checkout guardadas por Idempotency-Key: a repetição de uma requisição
+// (retry após timeout) recebe o mesmo corpo sem passar pela Store. Tabela em shards
+// com lock próprio, limitada em tamanho e com expiração; entradas saem em ordem de
+// criação (fila por shard), então expirar e despejar custa O(1) amortizado.
+class IdempotencyTable {
+public:
+    enum class Claim { New, InFlight, Done };
+private:
+    using Clock = chrono::steady_clock;
+    static constexpr size_t Shards = 16;
+    struct Entry { bool done = false; int status = 0; string body; Clock::time_point created; };
+    struct alignas(64) Shard {
+        mutex mtx;
+        unordered_map<string, Entry> entries;
+        deque<pair<string, Clock::time_point>> order; // (chave, criação) em ordem de chegada
+    };
+    Shard shards[Shards];
+    Clock::duration ttl;
+    size_t perShard;
+    atomic<uint64_t> replays{0}, conflicts{0};
+
+    Shard& shardOf(const string &key) { return shards[hash<string>()(key) % Shards]; }
+
+    // chamar com s.mtx adquirido
+    void trim(Shard &s, Clock::time_point now) {
+        while (!s.order.empty() && (s.order.front().second + ttl <= now || s.order.size() > perShard)) {
+            auto it = s.entries.find(s.order.front().first);
+            // a chave pode ter sido liberada e recriada: só remove a entrada desta criação
+            if (it != s.entries.end() && it->second.created == s.order.front().second) s.entries.erase(it);
+            s.order.pop_front();
+        }
+    }
+public:
+    IdempotencyTable(chrono::seconds ttl, size_t capacity): ttl(ttl), perShard(max<size_t>(capacity / Shards, 1)) {}
+
+    // New: a chave passa a estar em andamento e o chamador deve concluir com finish ou abandon.
+    // Done: status/body recebem a resposta guardada. InFlight: outra requisição com a mesma chave está rodando.
+    Claim begin(const string &key, int &status, string &body) {
+        auto &s = shardOf(key);
+        auto now = Clock::now();
+        lock_guard<mutex> lock(s.mtx);
+        trim(s, now);
+        auto it = s.entries.find(key);
+        if (it != s.entries.end()) {
+            if (!it->second.done) { conflicts.fetch_add(1, memory_order_relaxed); return Claim::InFlight; }
+            status = it->second.status;
+            body = it->second.body;
+            replays.fetch_add(1, memory_order_relaxed);
+            return Claim::Done;
+        }
+        s.entries.emplace(key, Entry{false, 0, string(), now});
+        s.order.emplace_back(key, now);
+        return Claim::New;
+    }
+    void finish(const string &key, int status, string body) {
+        auto &s = shardOf(key);
+        lock_guard<mutex> lock(s.mtx);
+        auto it = s.entries.find(key);
+        if (it == s.entries.end()) return; // despejada enquanto rodava
+        it->second.done = true;
+        it->second.status = status;
+        it->second.body = move(body);
+    }
+    // falhas não ficam guardadas: o cliente pode tentar de novo com a mesma chave
+    void abandon(const string &key) {
+        auto &s = shardOf(key);
+        lock_guard<mutex> lock(s.mtx);
+        s.entries.erase(key);
+    }
+
+    json stats() {
+        size_t size = 0;
+        for (auto &s : shards) { lock_guard<mutex> lock(s.mtx); size += s.entries.size(); }
+        return json{{"entries", size},{"replays", replays.load()},{"conflicts", conflicts.load()}};
+    }
+};
+
+// ---------- Configuração (linha de comando) ----------
+// Opções no formato --chave=valor, ex.: ./loja_server --checkout=combining --node=3
+struct ServerConfig {
+    CheckoutProcessor::Mode checkoutMode = CheckoutProcessor::Mode::Direct;
+    Store::StockLocking stockLocking = Store::StockLocking::Atomic;
+    int reservationTtl = 0; // segundos; 0 = sem reserva de estoque no carrinho
+    vector<int> flashSaleProducts; // ids com estoque dividido por núcleo
+    uint64_t node = 0; // distingue os ids de pedido de cada instância (0..63)
+    int checkoutWorkers = 0; // > 0 liga o checkout assíncrono com essa quantidade de workers
+    int checkoutQueue = 10000; // pedidos aguardando worker; além disso /checkout responde 503
+    int idempotencyTtl = 86400; // segundos que uma resposta de /checkout fica disponível para repetições
+    int idempotencyCapacity = 100000; // respostas guardadas no máximo (as mais antigas saem primeiro)
+    int cartShards = 0; // shards do SessionManager; 0 = 4 por núcleo
+    int cartIdleTtl = 0; // segundos sem acesso até o carrinho ser descartado; 0 = nunca
+    int cartMemoryMb = 0; // teto de memória dos carrinhos; 0 = sem limite
+
+    static ServerConfig fromArgs(int argc, char **argv) {
+        ServerConfig cfg;
+        for (int i = 1; i < argc; ++i) {
+            string arg = argv[i];
+            auto eq = arg.find('=');
+            string key = arg.substr(0, eq), value = eq == string::npos ? "" : arg.substr(eq + 1);
+            if (key == "--checkout" && value == "direct") cfg.checkoutMode = CheckoutProcessor::Mode::Direct;
+            else if (key == "--checkout" && value == "combining") cfg.checkoutMode = CheckoutProcessor::Mode::Combining;
+            else if (key == "--node") cfg.node = stoull(value);
+            else if (key == "--stock-locking" && value == "atomic") cfg.stockLocking = Store::StockLocking::Atomic;
+            else if (key == "--stock-locking" && value == "global") cfg.stockLocking = Store::StockLocking::Global;
+            else if (key == "--stock-locking" && value == "striped") cfg.stockLocking = Store::StockLocking::Striped;
+            else if (key == "--reservation-ttl") cfg.reservationTtl = stoi(value);
+            else if (key == "--checkout-async") cfg.checkoutWorkers = stoi(value);
+            else if (key == "--checkout-queue") cfg.checkoutQueue = stoi(value);
+            else if (key == "--idempotency-ttl") cfg.idempotencyTtl = stoi(value);
+            else if (key == "--idempotency-capacity") cfg.idempotencyCapacity = stoi(value);
+            else if (key == "--cart-shards") cfg.cartShards = stoi(value);
+            else if (key == "--cart-idle-ttl") cfg.cartIdleTtl = stoi(value);
+            else if (key == "--cart-memory-mb") cfg.cartMemoryMb = stoi(value);
+            else if (key == "--flash-sale") {
+                size_t pos = 0;
+                while (pos < value.size()) {
+                    size_t comma = value.find(',', pos);
+                    cfg.flashSaleProducts.push_back(stoi(value.substr(pos, comma - pos)));
+                    pos = comma == string::npos ? value.size() : comma + 1;
+                }
+            }
+            else throw invalid_argument("Opção inválida: " + arg);
+        }
+        return cfg;
     }
-    vector<CartItem> getCart(int customerId) { lock_guard<mutex> lock(mtx); return carts[customerId]; }
-    void clearCart(int customerId) { lock_guard<mutex> lock(mtx); carts.erase(customerId); }
 };
 
 // ---------- Servidor REST (endpoints básicos) ----------
-int main() {
-    Store store;
-    SessionManager sessions;
+int main(int argc, char **argv) {
+    ServerConfig config;
+    try { config = ServerConfig::fromArgs(argc, argv); }
+    catch (const exception &e) { cerr << e.what() << "\nUso: " << argv[0] << " [--checkout=direct|combining] [--node=0..63] [--stock-locking=atomic|global|striped] [--reservation-ttl=segundos] [--flash-sale=id,id,...] [--checkout-async=workers] [--checkout-queue=n] [--idempotency-ttl=segundos] [--idempotency-capacity=n] [--cart-shards=n] [--cart-idle-ttl=segundos] [--cart-memory-mb=n]\n"; return 1; }
+    if (config.node > OrderIdGenerator::MaxNode) { cerr << "--node deve estar entre 0 e " << OrderIdGenerator::MaxNode << "\n"; return 1; }
+    if (config.checkoutWorkers < 0 || config.checkoutQueue <= 0) { cerr << "--checkout-async e --checkout-queue devem ser positivos\n"; return 1; }
+    if (config.idempotencyTtl <= 0 || config.idempotencyCapacity <= 0) { cerr << "--idempotency-ttl e --idempotency-capacity devem ser positivos\n"; return 1; }
+    if (config.reservationTtl < 0 || config.reservationTtl > SessionManager::MaxReservationTtl) { cerr << "--reservation-ttl deve estar entre 0 e " << SessionManager::MaxReservationTtl << "\n"; return 1; }
+    if (config.cartShards < 0 || config.cartIdleTtl < 0 || config.cartMemoryMb < 0) { cerr << "--cart-shards, --cart-idle-ttl e --cart-memory-mb não podem ser negativos\n"; return 1; }
+
+    Store store(config.stockLocking);
+    SessionManager sessions(config.cartShards);
+    if (config.reservationTtl > 0) sessions.enableReservations(store, chrono::seconds(config.reservationTtl));
+    sessions.enableEviction(chrono::seconds(config.cartIdleTtl), size_t(config.cartMemoryMb) << 20);
+    OrderRepository orders;
+    OrderIdGenerator orderIds(config.node);
+    CheckoutProcessor checkout(store, orderIds, config.checkoutMode);
+    unique_ptr<AsyncCheckout> asyncCheckout;
+    if (config.checkoutWorkers > 0) asyncCheckout = make_unique<AsyncCheckout>(checkout, orders, sessions, config.checkoutWorkers, config.checkoutQueue);
+    ResponseCache productsCache; // corpo de GET /products
+    IdempotencyTable idempotency(chrono::seconds(config.idempotencyTtl), config.idempotencyCapacity);
 
     // Popular com alguns produtos de exemplo
     store.addProduct(Product(1, "Teclado Mecânico", "Teclado retroiluminado", 299.90, 10));
     store.addProduct(Product(2, "Mouse Gamer", "Mouse com alta precisão", 149.50, 5));
     store.addProduct(Product(3, "Monitor 24-inch", "Full HD 75Hz", 899.00, 2));
+    for (int id : config.flashSaleProducts)
+        if (!store.enableFlashSale(id)) cerr << "--flash-sale: produto " << id << " não existe\n";
 
     httplib::Server svr;
 
     // GET /products -> lista todos
-    svr.Get("/products", [&](const httplib::Request&, httplib::Response &res){
-        auto prods = store.listProducts();
+    // GET /products?after={id}&limit={n} -> página (ordem por id) com cursor "nextAfter"
+    // GET /products?stream=1[&after={id}] -> lista enviada em chunks, sem montar o JSON inteiro
+    // GET /products?minPrice=100&maxPrice=500&sort=price_asc|price_desc[&limit={n}] -> faixa de preço ordenada
+    svr.Get("/products", [&](const httplib::Request &req, httplib::Response &res){
+        // lidas antes do snapshot: com ele na versão de estrutura lida, o corpo nunca é mais
+        // antigo que a chave. snapshot() pode devolver a versão anterior enquanto outra
+        // thread copia o catálogo; esse corpo é servido, mas não entra no cache.
+        uint64_t version = store.currentVersion(), structure = store.currentStructureVersion();
+        auto snap = store.snapshot();
+        bool stream = req.has_param("stream") && req.get_param_value("stream") != "0";
+        bool byPrice = req.has_param("minPrice") || req.has_param("maxPrice") || req.has_param("sort");
+        if (byPrice) {
+            double minPrice = 0, maxPrice = numeric_limits<double>::infinity();
+            size_t limit = 100;
+            bool desc = false;
+            try {
+                if (req.has_param("after") || stream) throw invalid_argument("after/stream");
+                if (req.has_param("minPrice")) minPrice = stod(req.get_param_value("minPrice"));
+                if (req.has_param("maxPrice")) maxPrice = stod(req.get_param_value("maxPrice"));
+                if (req.has_param("sort")) {
+                    string sort = req.get_param_value("sort");
+                    if (sort != "price_asc" && sort != "price_desc") throw invalid_argument("sort");
+                    desc = sort == "price_desc";
+                }
+                if (req.has_param("limit")) { int l = stoi(req.get_param_value("limit")); if (l <= 0) throw invalid_argument("limit"); limit = min<size_t>(l, 1000); }
+            } catch (...) { res.status=400; res.set_content("{\"error\":\"Parâmetros minPrice/maxPrice/sort/limit inválidos\"}", "application/json"); return; }
+            auto range = snap->priceRange(minPrice, maxPrice);
+            size_t count = range.second > range.first ? range.second - range.first : 0;
+            json arr = json::array();
+            for (size_t k = 0; k < min(count, limit); ++k) {
+                size_t pos = desc ? range.second - 1 - k : range.first + k;
+                arr.push_back(snap->catalog.view(snap->byPrice[pos]).toJson());
+            }
+            json out{{"items", arr},{"count", count}};
+            res.set_content(out.dump(4), "application/json");
+            return;
+        }
+        if (!stream && !req.has_param("after") && !req.has_param("limit")) {
+            auto render = [&]{
+                json arr = json::array();
+                for (size_t i = 0; i < snap->size(); ++i) arr.push_back(snap->at(i).toJson());
+                return arr.dump(4);
+            };
+            if (snap->version < structure) { res.set_content(render(), "application/json"); return; }
+            auto body = productsCache.get(version, render);
+            res.set_content(*body, "application/json");
+            return;
+        }
+        size_t begin = 0, limit = 0;
+        try {
+            if (req.has_param("after")) begin = snap->positionAfter(stoi(req.get_param_value("after")));
+            if (req.has_param("limit")) { int l = stoi(req.get_param_value("limit")); if (l <= 0) throw invalid_argument("limit"); limit = l; }
+        } catch (...) { res.status=400; res.set_content("{\"error\":\"Parâmetros after/limit inválidos\"}", "application/json"); return; }
+
+        if (stream) {
+            size_t end = limit ? min(snap->size(), begin + limit) : snap->size();
+            auto pos = make_shared<size_t>(begin);
+            // o snapshot capturado mantém a versão viva até o fim do envio
+            res.set_chunked_content_provider("application/json", [snap, pos, begin, end](size_t, httplib::DataSink &sink){
+                const size_t batch = 256; // memória por requisição limitada a um lote
+                string buf = (*pos == begin) ? "[" : "";
+                size_t stop = min(end, *pos + batch);
+                for (; *pos < stop; ++*pos) {
+                    if (*pos != begin) buf += ',';
+                    buf += snap->at(*pos).toJson().dump();
+                }
+                if (*pos == end) buf += ']';
+                if (!sink.write(buf.data(), buf.size())) return false;
+                if (*pos == end) sink.done();
+                return true;
+            });
+            return;
+        }
+
+        const size_t maxPage = 1000;
+        limit = limit ? min(limit, maxPage) : 100;
+        size_t end = min(snap->size(), begin + limit);
         json arr = json::array();
-        for (const auto &p : prods) arr.push_back(p.toJson());
-        res.set_content(arr.dump(4), "application/json");
+        for (size_t i = begin; i < end; ++i) arr.push_back(snap->at(i).toJson());
+        json out{{"items", arr},{"nextAfter", nullptr}};
+        if (end < snap->size()) out["nextAfter"] = snap->at(end-1).getId();
+        res.set_content(out.dump(4), "application/json");
     });
 
     // GET /product?id=1 -> obtém produto por id via query string
     svr.Get("/product", [&](const httplib::Request &req, httplib::Response &res){
         if (req.has_param("id")) {
             int id = stoi(req.get_param_value("id"));
-            Product *p = store.findProductById(id);
-            if (!p) { res.status = 404; res.set_content("{\"error\":\"Produto não encontrado\"}", "application/json"); return; }
-            res.set_content(p->toJson().dump(), "application/json");
+            bool found = store.withProduct(id, [&](const ProductView &p){ res.set_content(p.toJson().dump(), "application/json"); });
+            if (!found) { res.status = 404; res.set_content("{\"error\":\"Produto não encontrado\"}", "application/json"); }
             return;
         }
         res.status = 400; res.set_content("{\"error\":\"Parâmetro id necessário\"}", "application/json");
@@ -226,11 +2013,16 @@ int main() {
             int productId = j.value("productId", 0);
             int qty = j.value("qty", 1);
             if (customerId<=0 || productId<=0 || qty<=0) { res.status=400; res.set_content("{\"error\":\"Parâmetros inválidos\"}", "application/json"); return; }
-            Product *p = store.findProductById(productId);
-            if (!p) { res.status=404; res.set_content("{\"error\":\"Produto não encontrado\"}", "application/json"); return; }
-            if (p->getStock() <= 0) { res.status=400; res.set_content("{\"error\":\"Produto sem estoque\"}", "application/json"); return; }
-            CartItem item{p->getId(), p->getName(), p->getPrice(), qty};
-            sessions.addToCart(customerId, item);
+            optional<CartEntry> item;
+            int stock = 0;
+            bool found = store.withProduct(productId, [&](const ProductView &p){
+                stock = p.getStock();
+                item = CartEntry{p.getPrice(), p.getId(), qty, 0, p.getNameId()};
+            });
+            if (!found) { res.status=404; res.set_content("{\"error\":\"Produto não encontrado\"}", "application/json"); return; }
+            if (stock <= 0) { res.status=400; res.set_content("{\"error\":\"Produto sem estoque\"}", "application/json"); return; }
+            string err;
+            if (!sessions.addToCart(customerId, *item, err)) { res.status=409; json out{{"error", err}}; res.set_content(out.dump(), "application/json"); return; }
             res.set_content("{\"ok\":true}", "application/json");
         } catch (...) { res.status=400; res.set_content("{\"error\":\"JSON inválido\"}", "application/json"); }
     });
@@ -239,28 +2031,249 @@ int main() {
     svr.Get("/cart", [&](const httplib::Request &req, httplib::Response &res){
         if (!req.has_param("customerId")) { res.status=400; res.set_content("{\"error\":\"Parâmetro customerId necessário\"}", "application/json"); return; }
         int customerId = stoi(req.get_param_value("customerId"));
-        auto cart = sessions.getCart(customerId);
-        json arr = json::array(); double sum=0;
-        for (const auto &it : cart) { arr.push_back(it.toJson()); sum += it.subtotal(); }
-        json out{{"customerId", customerId},{"items", arr},{"subtotal", sum}};
+        bool summary = req.has_param("summary") && req.get_param_value("summary") != "0";
+        json arr = json::array();
+        SessionManager::CartTotals totals;
+        sessions.withCart(customerId, [&](const SessionManager::CartItems &cart, const SessionManager::CartTotals &t){
+            totals = t;
+            if (!summary) for (const auto &it : cart) arr.push_back(it.toJson());
+        });
+        json out{{"customerId", customerId},{"subtotal", totals.subtotal()},{"units", totals.units}};
+        if (!summary) out["items"] = move(arr);
         res.set_content(out.dump(4), "application/json");
     });
 
-    // POST /checkout -> body JSON: {"customerId":1}
-    svr.Post("/checkout", [&](const httplib::Request &req, httplib::Response &res){
+    // POST /cart/update -> body JSON: {"customerId":1, "productId":2, "qty":3} (qty 0 remove o item)
+    // POST /cart/remove -> body JSON: {"customerId":1, "productId":2}
+    auto updateCart = [&](const httplib::Request &req, httplib::Response &res, bool remove) {
         try {
             auto j = json::parse(req.body);
             int customerId = j.value("customerId", 0);
-            if (customerId<=0) { res.status=400; res.set_content("{\"error\":\"customerId inválido\"}", "application/json"); return; }
-            auto cart = sessions.getCart(customerId);
-            if (cart.empty()) { res.status=400; res.set_content("{\"error\":\"Carrinho vazio\"}", "application/json"); return; }
-            int orderId = store.generateOrderId();
-            Order order(orderId, cart);
+            int productId = j.value("productId", 0);
+            int qty = remove ? 0 : j.value("qty", -1);
+            if (customerId<=0 || productId<=0 || qty<0) { res.status=400; res.set_content("{\"error\":\"Parâmetros inválidos\"}", "application/json"); return; }
             string err;
-            if (!store.placeOrder(order, err)) { res.status=400; json out{{"ok", false},{"error", err}}; res.set_content(out.dump(), "application/json"); return; }
-            sessions.clearCart(customerId);
-            res.set_content(order.toJson().dump(4), "application/json");
+            switch (sessions.updateCartItem(customerId, productId, qty, err)) {
+                case SessionManager::UpdateResult::NotInCart: res.status=404; break;
+                case SessionManager::UpdateResult::OutOfStock:
+                case SessionManager::UpdateResult::CheckoutPending: res.status=409; break;
+                case SessionManager::UpdateResult::Ok: res.set_content("{\"ok\":true}", "application/json"); return;
+            }
+            json out{{"error", err}};
+            res.set_content(out.dump(), "application/json");
         } catch (...) { res.status=400; res.set_content("{\"error\":\"JSON inválido\"}", "application/json"); }
+    };
+    svr.Post("/cart/update", [&](const httplib::Request &req, httplib::Response &res){ updateCart(req, res, false); });
+    svr.Post("/cart/remove", [&](const httplib::Request &req, httplib::Response &res){ updateCart(req, res, true); });
+
+    // checkout de um carrinho; true quando o pedido foi criado (ou enfileirado)
+    auto runCheckout = [&](int customerId, httplib::Response &res) {
+        double subtotal = 0.0;
+        vector<CartItem> cart;
+        switch (sessions.claimCart(customerId, cart, &subtotal)) {
+            case SessionManager::ClaimResult::Empty: res.status=400; res.set_content("{\"error\":\"Carrinho vazio\"}", "application/json"); return false;
+            case SessionManager::ClaimResult::CheckoutPending: res.status=409; res.set_content("{\"error\":\"Checkout deste carrinho em andamento\"}", "application/json"); return false;
+            case SessionManager::ClaimResult::Ok: break;
+        }
+        if (asyncCheckout) {
+            int64_t id = orderIds.next();
+            if (!asyncCheckout->submit(id, customerId, cart, subtotal)) { sessions.restoreReservations(customerId, cart); res.status=503; res.set_content("{\"error\":\"Fila de checkout cheia, tente novamente\"}", "application/json"); return false; }
+            res.status=202;
+            json out{{"orderId", to_string(id)},{"status", "pending"}};
+            res.set_content(out.dump(4), "application/json");
+            return true;
+        }
+        Order order;
+        string err;
+        if (!checkout.place(customerId, cart, order, err, 0, subtotal)) { sessions.restoreReservations(customerId, cart); res.status=400; json out{{"ok", false},{"error", err}}; res.set_content(out.dump(), "application/json"); return false; }
+        orders.add(order);
+        sessions.finishClaim(customerId, cart);
+        res.status=200;
+        res.set_content(order.toJson().dump(4), "application/json");
+        return true;
+    };
+
+    // POST /checkout -> body JSON: {"customerId":1}
+    // com --checkout-async responde 202 {"orderId":"..","status":"pending"}; acompanhar em /checkout/status
+    // Header opcional Idempotency-Key: repetições recebem a mesma resposta (com Idempotent-Replayed: true);
+    // 409 enquanto a primeira ainda estiver rodando. Só respostas de sucesso ficam guardadas.
+    svr.Post("/checkout", [&](const httplib::Request &req, httplib::Response &res){
+        int customerId = 0;
+        try { customerId = json::parse(req.body).value("customerId", 0); }
+        catch (...) { res.status=400; res.set_content("{\"error\":\"JSON inválido\"}", "application/json"); return; }
+        if (customerId<=0) { res.status=400; res.set_content("{\"error\":\"customerId inválido\"}", "application/json"); return; }
+        string key = req.get_header_value("Idempotency-Key");
+        if (key.empty()) { runCheckout(customerId, res); return; }
+        key = to_string(customerId) + ":" + key; // chaves de clientes diferentes não colidem
+        int status = 0;
+        string body;
+        switch (idempotency.begin(key, status, body)) {
+            case IdempotencyTable::Claim::InFlight: res.status=409; res.set_content("{\"error\":\"Checkout com esta Idempotency-Key em andamento\"}", "application/json"); return;
+            case IdempotencyTable::Claim::Done: res.status=status; res.set_header("Idempotent-Replayed", "true"); res.set_content(body, "application/json"); return;
+            case IdempotencyTable::Claim::New: break;
+        }
+        try {
+            if (runCheckout(customerId, res)) idempotency.finish(key, res.status, res.body);
+            else idempotency.abandon(key);
+        } catch (...) { idempotency.abandon(key); throw; }
+    });
+
+    // POST /checkout/batch -> body JSON: {"orders":[{"customerId":1},{"customerId":2,"items":[{"productId":1,"qty":2}]}]}
+    // Sem "items" usa o carrinho da sessão; com "items" o pedido é montado direto do catálogo
+    // (integrações). Sempre síncrono; a resposta traz um resultado por pedido, na mesma ordem.
+    svr.Post("/checkout/batch", [&](const httplib::Request &req, httplib::Response &res){
+        const size_t maxBatch = 1000;
+        json j;
+        try { j = json::parse(req.body); } catch (...) { res.status=400; res.set_content("{\"error\":\"JSON inválido\"}", "application/json"); return; }
+        const json &entries = j.is_array() ? j : j.is_object() ? j.value("orders", json()) : json();
+        if (!entries.is_array() || entries.empty()) { res.status=400; res.set_content("{\"error\":\"Lista de pedidos vazia\"}", "application/json"); return; }
+        if (entries.size() > maxBatch) { res.status=413; res.set_content("{\"error\":\"Lote acima de 1000 pedidos\"}", "application/json"); return; }
+
+        // campo inteiro opcional; false se vier com outro tipo ou fora da faixa de int
+        auto intField = [](const json &o, const char *key, int def, int &out) {
+            auto f = o.find(key);
+            if (f == o.end()) { out = def; return true; }
+            if (!f->is_number_integer()) return false;
+            int64_t v = f->get<int64_t>();
+            if (v < numeric_limits<int>::min() || v > numeric_limits<int>::max()) return false;
+            out = int(v);
+            return true;
+        };
+
+        // 1ª passada: só valida e monta os carrinhos explícitos, sem efeitos colaterais,
+        // para que nenhum erro de entrada aconteça depois de um carrinho já reivindicado
+        json results = json::array();
+        vector<pair<int, vector<CartItem>>> carts;
+        vector<size_t> positions; // carts[k] -> posição na requisição
+        vector<bool> fromSession;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            const json &e = entries[i];
+            int customerId = 0;
+            bool valid = e.is_object() && intField(e, "customerId", 0, customerId) && customerId > 0;
+            results.push_back(json{{"customerId", customerId},{"ok", false}});
+            if (!valid) { results[i]["error"] = "customerId inválido"; continue; }
+            vector<CartItem> cart;
+            string err;
+            bool explicitItems = e.contains("items");
+            if (explicitItems) {
+                if (!e["items"].is_array()) err = "Item inválido";
+                else for (const auto &it : e["items"]) {
+                    int productId = 0, qty = 0;
+                    if (!it.is_object() || !intField(it, "productId", 0, productId) || !intField(it, "qty", 1, qty) || productId<=0 || qty<=0) { err = "Item inválido"; break; }
+                    if (!store.withProduct(productId, [&](const ProductView &p){ cart.push_back(CartItem{p.getId(), string(p.getName()), p.getPrice(), qty}); })) { err = "Produto não encontrado: " + to_string(productId); break; }
+                }
+                if (err.empty() && cart.empty()) err = "Carrinho vazio";
+            }
+            if (!err.empty()) { results[i]["error"] = err; continue; }
+            carts.emplace_back(customerId, move(cart));
+            positions.push_back(i);
+            fromSession.push_back(!explicitItems);
+        }
+
+        // 2ª passada: reivindica os carrinhos da sessão (a partir daqui nada lança)
+        size_t kept = 0;
+        for (size_t k = 0; k < carts.size(); ++k) {
+            string err;
+            if (fromSession[k]) {
+                switch (sessions.claimCart(carts[k].first, carts[k].second)) {
+                    case SessionManager::ClaimResult::Empty: err = "Carrinho vazio"; break;
+                    case SessionManager::ClaimResult::CheckoutPending: err = "Checkout deste carrinho em andamento"; break; // inclusive repetido no lote
+                    case SessionManager::ClaimResult::Ok: break;
+                }
+            }
+            if (!err.empty()) { results[positions[k]]["error"] = err; continue; }
+            if (kept != k) { carts[kept] = move(carts[k]); positions[kept] = positions[k]; fromSession[kept] = fromSession[k]; }
+            ++kept;
+        }
+        carts.resize(kept);
+        positions.resize(kept);
+        fromSession.resize(kept);
+
+        vector<Order> placed;
+        vector<string> errs;
+        vector<bool> ok = checkout.placeBatch(carts, placed, errs);
+        size_t okCount = 0;
+        for (size_t k = 0; k < carts.size(); ++k) {
+            json &r = results[positions[k]];
+            int customerId = carts[k].first;
+            if (!ok[k]) {
+                if (fromSession[k]) sessions.restoreReservations(customerId, carts[k].second);
+                r["error"] = errs[k];
+                continue;
+            }
+            orders.add(placed[k]);
+            if (fromSession[k]) sessions.finishClaim(customerId, carts[k].second);
+            r["ok"] = true;
+            r["order"] = placed[k].toJson();
+            ++okCount;
+        }
+        json out{{"placed", okCount},{"failed", entries.size() - okCount}};
+        out["results"] = move(results);
+        res.set_content(out.dump(4), "application/json");
+    });
+
+    // GET /checkout/status?id=1 -> pending | done (com o pedido) | failed (com o erro)
+    svr.Get("/checkout/status", [&](const httplib::Request &req, httplib::Response &res){
+        if (!req.has_param("id")) { res.status=400; res.set_content("{\"error\":\"Parâmetro id necessário\"}", "application/json"); return; }
+        auto parsed = OrderIdGenerator::parse(req.get_param_value("id"));
+        if (!parsed) { res.status=400; res.set_content("{\"error\":\"Parâmetro id inválido\"}", "application/json"); return; }
+        int64_t id = *parsed;
+        string err;
+        auto state = asyncCheckout ? asyncCheckout->status(id, err) : (orders.findById(id) ? AsyncCheckout::State::Done : AsyncCheckout::State::Unknown);
+        json out{{"orderId", to_string(id)}};
+        switch (state) {
+            case AsyncCheckout::State::Pending: out["status"] = "pending"; break;
+            case AsyncCheckout::State::Failed: out["status"] = "failed"; out["error"] = err; break;
+            case AsyncCheckout::State::Done: out["status"] = "done"; out["order"] = orders.findById(id)->toJson(); break;
+            case AsyncCheckout::State::Unknown: res.status=404; res.set_content("{\"error\":\"Pedido não encontrado\"}", "application/json"); return;
+        }
+        res.set_content(out.dump(4), "application/json");
+    });
+
+    // GET /orders?customerId=1 -> histórico de pedidos do cliente
+    svr.Get("/orders", [&](const httplib::Request &req, httplib::Response &res){
+        if (!req.has_param("customerId")) { res.status=400; res.set_content("{\"error\":\"Parâmetro customerId necessário\"}", "application/json"); return; }
+        int customerId = stoi(req.get_param_value("customerId"));
+        json arr = json::array();
+        for (const auto &o : orders.findByCustomer(customerId)) arr.push_back(o.toJson());
+        json out{{"customerId", customerId},{"orders", arr}};
+        res.set_content(out.dump(4), "application/json");
+    });
+
+    // GET /order?id=1 -> pedido por id
+    svr.Get("/order", [&](const httplib::Request &req, httplib::Response &res){
+        if (!req.has_param("id")) { res.status=400; res.set_content("{\"error\":\"Parâmetro id necessário\"}", "application/json"); return; }
+        auto id = OrderIdGenerator::parse(req.get_param_value("id"));
+        if (!id) { res.status=400; res.set_content("{\"error\":\"Parâmetro id inválido\"}", "application/json"); return; }
+        auto o = orders.findById(*id);
+        if (!o) { res.status=404; res.set_content("{\"error\":\"Pedido não encontrado\"}", "application/json"); return; }
+        res.set_content(o->toJson().dump(4), "application/json");
+    });
+
+    // GET /search?q=teclado&limit=20 -> produtos com todos os termos, mais relevantes primeiro
+    svr.Get("/search", [&](const httplib::Request &req, httplib::Response &res){
+        if (!req.has_param("q")) { res.status=400; res.set_content("{\"error\":\"Parâmetro q necessário\"}", "application/json"); return; }
+        size_t limit = 20;
+        try {
+            if (req.has_param("limit")) { int l = stoi(req.get_param_value("limit")); if (l <= 0) throw invalid_argument("limit"); limit = min(l, 100); }
+        } catch (...) { res.status=400; res.set_content("{\"error\":\"Parâmetro limit inválido\"}", "application/json"); return; }
+        string q = req.get_param_value("q");
+        json arr = json::array();
+        for (const auto &hit : store.search(q, limit)) {
+            json item = hit.second.toJson();
+            item["score"] = hit.first;
+            arr.push_back(item);
+        }
+        json out{{"query", q},{"items", arr}};
+        res.set_content(out.dump(4), "application/json");
+    });
+
+    // GET /stats -> contadores internos (cache de respostas, checkout)
+    svr.Get("/stats", [&](const httplib::Request&, httplib::Response &res){
+        json out{{"productsCache", productsCache.stats()},{"checkout", checkout.stats()},{"store", store.stats()},{"sessions", sessions.stats()}};
+        if (asyncCheckout) out["checkoutQueue"] = asyncCheckout->stats();
+        out["idempotency"] = idempotency.stats();
+        res.set_content(out.dump(4), "application/json");
     });
 
     cout << "Servidor rodando em http://localhost:8080
@@ -271,11 +2284,26 @@ int main() {
 
 
 ---------- Endpoints (resumo) ----------
-- GET  /products             -> lista todos os produtos
+- GET  /products             -> lista todos os produtos (ordenados por id)
+- GET  /products?after={id}&limit={n} -> página de até n produtos (máx. 1000) com id > after; "nextAfter" é o cursor da próxima
+- GET  /products?stream=1    -> mesma lista enviada em chunks (aceita after/limit)
+- GET  /products?minPrice={a}&maxPrice={b}&sort=price_asc|price_desc&limit={n} -> produtos na faixa de preço, ordenados;
+                               "count" traz o total na faixa (não combina com after/stream)
 - GET  /product?id={id}     -> obtém produto por id (query string)
-- POST /cart/add             -> adiciona item ao carrinho (JSON: customerId, productId, qty)
-- GET  /cart?customerId={id} -> visualiza carrinho
-- POST /checkout             -> efetua checkout (JSON: customerId)
+- POST /cart/add             -> adiciona item ao carrinho (JSON: customerId, productId, qty); 409 se a reserva falhar
+- GET  /cart?customerId={id} -> visualiza carrinho (subtotal e unidades mantidos a cada alteração; summary=1 omite os itens)
+- POST /cart/update          -> altera a quantidade de um item (JSON: customerId, productId, qty; 0 remove); 404/409 em falha (409 também durante um checkout)
+- POST /cart/remove          -> remove um item do carrinho (JSON: customerId, productId)
+- POST /checkout             -> efetua checkout (JSON: customerId); com --checkout-async responde 202 com o orderId;
+                               header Idempotency-Key opcional: repetições devolvem a mesma resposta (409 se ainda em andamento)
+                               409 se já houver um checkout do mesmo carrinho sem resultado; itens incluídos depois ficam no carrinho
+- POST /checkout/batch       -> vários checkouts numa só chamada (JSON: orders = [{customerId[, items: [{productId, qty}]]}]);
+                               sem items usa o carrinho da sessão; até 1000 pedidos, um resultado por pedido
+- GET  /checkout/status?id={id} -> andamento do checkout assíncrono: pending, done (com o pedido) ou failed (com o erro)
+- GET  /orders?customerId={id} -> pedidos já fechados do cliente
+- GET  /order?id={id}        -> pedido por id (ids de pedido são strings no JSON: passam de 2^53)
+- GET  /search?q={texto}&limit={n} -> busca por nome/descrição (todos os termos, sem diferenciar acentos e maiúsculas), ordenada por relevância
+- GET  /stats                -> contadores internos (hits/misses do cache de /products, lotes do checkout)
 
 ---------- Instruções rápidas de teste (curl) ----------
 1) Listar produtos:
@@ -290,6 +2318,9 @@ int main() {
 4) Checkout:
    curl -X POST -H "Content-Type: application/json" -d '{"customerId":1}' http://localhost:8080/checkout
 
+5) Histórico de pedidos:
+   curl http://localhost:8080/orders?customerId=1
+
 ---------- Próximos passos sugeridos ----------
 - Adicionar persistência com SQLite (ex.: sqlite3 + wrapper) para produtos, pedidos e sessões.
 - Implementar autenticação (JWT) e gerenciamento de usuários (customers/admins).